@@ -0,0 +1,218 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "BinaryMesh.hpp" // MappedFile, fileStamp
+
+// One file holding every asset Final loads, already decoded, written by
+// `Final --pack <archive>` and mapped at startup.
+//
+// File layout (native little-endian):
+//   AssetArchiveHeader
+//   AssetEntry[count]
+//   payloads, each starting on a 64 byte boundary
+//
+// Payloads are what the loose-file loaders would have produced:
+//   Sound    SoundAssetHeader, then frames left floats, then frames right
+//            floats, at the rate the app was packed for
+//   Mesh     a whole .bmesh file (BinaryMesh.hpp)
+//   Texture  a whole .mips file (TextureCache.hpp)
+// so loaders get pointers straight into the mapping instead of decoding.
+//
+// Assets are looked up by file name. An entry remembers the size and
+// modification time of the file it was packed from; when that file is around
+// and has changed, the entry is ignored and the loose file is loaded.
+
+static const char kAssetArchiveMagic[4] = {'A', 'P', 'A', 'K'};
+static const uint32_t kAssetArchiveVersion = 1;
+
+enum class AssetType : uint32_t { Sound = 1, Mesh = 2, Texture = 3 };
+
+struct AssetArchiveHeader
+{
+  char magic[4];
+  uint32_t version;
+  uint32_t count;
+  uint32_t reserved;
+};
+
+struct AssetEntry
+{
+  char name[64];
+  uint32_t type;
+  uint32_t reserved;
+  uint64_t offset; // bytes from start of file
+  uint64_t size;
+  uint64_t sourceSize;
+  int64_t sourceMTime;
+};
+
+struct SoundAssetHeader
+{
+  uint32_t frames;
+  float sampleRate;
+  uint32_t reserved[2];
+};
+
+inline std::string assetName(const std::string &path)
+{
+  size_t slash = path.find_last_of("/\\");
+  return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+// Read side. open() once before anything loads, then find() from any thread.
+class AssetArchive
+{
+public:
+  struct View
+  {
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+    explicit operator bool() const { return data != nullptr; }
+  };
+
+  static AssetArchive &instance()
+  {
+    static AssetArchive archive;
+    return archive;
+  }
+
+  bool open(const std::string &path)
+  {
+    mEntries = nullptr;
+    mCount = 0;
+    if (!mFile.open(path)) return false;
+    if (mFile.size() < sizeof(AssetArchiveHeader)) return fail(path);
+    const AssetArchiveHeader &h = *(const AssetArchiveHeader *)mFile.data();
+    const size_t tableEnd = sizeof(AssetArchiveHeader) + (size_t)h.count * sizeof(AssetEntry);
+    if (memcmp(h.magic, kAssetArchiveMagic, 4) != 0 || h.version != kAssetArchiveVersion ||
+        tableEnd > mFile.size())
+      return fail(path);
+    const AssetEntry *entries = (const AssetEntry *)(mFile.data() + sizeof(AssetArchiveHeader));
+    for (uint32_t i = 0; i < h.count; ++i)
+      if (entries[i].offset + entries[i].size > mFile.size() || entries[i].name[63] != 0) return fail(path);
+    mEntries = entries;
+    mCount = h.count;
+    return true;
+  }
+
+  bool isOpen() const { return mEntries != nullptr; }
+
+  // The packed copy of the file at `path`, empty if it isn't packed or the
+  // file changed since
+  View find(const std::string &path, AssetType type) const
+  {
+    const std::string name = assetName(path);
+    for (uint32_t i = 0; i < mCount; ++i) {
+      const AssetEntry &e = mEntries[i];
+      if (e.type != (uint32_t)type || name != e.name) continue;
+      uint64_t size;
+      int64_t mtime;
+      if (fileStamp(path, size, mtime) && (size != e.sourceSize || mtime != e.sourceMTime)) {
+        printf("AssetArchive: %s changed since it was packed, loading the file\n", path.c_str());
+        return View();
+      }
+      return {mFile.data() + e.offset, (size_t)e.size};
+    }
+    return View();
+  }
+
+  // The samples of a Sound payload. False if it's malformed.
+  static bool sound(View v, SoundAssetHeader &header, const float *&left, const float *&right)
+  {
+    if (v.size < sizeof(SoundAssetHeader)) return false;
+    memcpy(&header, v.data, sizeof(header));
+    if (v.size < sizeof(SoundAssetHeader) + 2 * (size_t)header.frames * sizeof(float)) return false;
+    left = (const float *)(v.data + sizeof(SoundAssetHeader));
+    right = left + header.frames;
+    return true;
+  }
+
+private:
+  AssetArchive() {}
+
+  bool fail(const std::string &path)
+  {
+    printf("AssetArchive: %s is not a valid archive\n", path.c_str());
+    mFile.close();
+    return false;
+  }
+
+  MappedFile mFile;
+  const AssetEntry *mEntries = nullptr;
+  uint32_t mCount = 0;
+};
+
+// Write side, used by --pack
+class AssetArchiveWriter
+{
+public:
+  // `path` is the loose file the payload came from, for its name and stamp
+  void add(const std::string &path, AssetType type, std::vector<uint8_t> payload)
+  {
+    AssetEntry e = {};
+    strncpy(e.name, assetName(path).c_str(), sizeof(e.name) - 1);
+    e.type = (uint32_t)type;
+    e.size = payload.size();
+    fileStamp(path, e.sourceSize, e.sourceMTime);
+    mEntries.push_back(e);
+    mPayloads.push_back(std::move(payload));
+  }
+
+  static std::vector<uint8_t> sound(const float *left, const float *right, int frames, double sampleRate)
+  {
+    SoundAssetHeader h = {};
+    h.frames = (uint32_t)frames;
+    h.sampleRate = (float)sampleRate;
+    std::vector<uint8_t> payload(sizeof(h) + 2 * (size_t)frames * sizeof(float));
+    memcpy(payload.data(), &h, sizeof(h));
+    memcpy(payload.data() + sizeof(h), left, frames * sizeof(float));
+    memcpy(payload.data() + sizeof(h) + frames * sizeof(float), right, frames * sizeof(float));
+    return payload;
+  }
+
+  // Through a temporary name, so a running app never maps half an archive
+  bool write(const std::string &path)
+  {
+    uint64_t offset = align(sizeof(AssetArchiveHeader) + mEntries.size() * sizeof(AssetEntry));
+    for (size_t i = 0; i < mEntries.size(); ++i) {
+      mEntries[i].offset = offset;
+      offset = align(offset + mEntries[i].size);
+    }
+    AssetArchiveHeader h = {};
+    memcpy(h.magic, kAssetArchiveMagic, 4);
+    h.version = kAssetArchiveVersion;
+    h.count = (uint32_t)mEntries.size();
+
+    const std::string tmp = path + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (!f) {
+      printf("AssetArchive: could not write %s\n", tmp.c_str());
+      return false;
+    }
+    fwrite(&h, sizeof(h), 1, f);
+    fwrite(mEntries.data(), sizeof(AssetEntry), mEntries.size(), f);
+    for (size_t i = 0; i < mEntries.size(); ++i) {
+      fseek(f, (long)mEntries[i].offset, SEEK_SET);
+      fwrite(mPayloads[i].data(), 1, mPayloads[i].size(), f);
+    }
+    bool ok = ferror(f) == 0;
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0) {
+      printf("AssetArchive: could not write %s\n", path.c_str());
+      std::remove(tmp.c_str());
+      return false;
+    }
+    return true;
+  }
+
+private:
+  static uint64_t align(uint64_t offset) { return (offset + 63) & ~(uint64_t)63; }
+
+  std::vector<AssetEntry> mEntries;
+  std::vector<std::vector<uint8_t>> mPayloads;
+};
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Log spaced histogram of durations, written by one thread and read by any
+// other without locks. Buckets are a quarter octave wide, from 1 us up to
+// about 65 ms; anything outside lands in the first or last bucket.
+class TimingHistogram
+{
+public:
+  static const int numBuckets = 64;
+
+  // Writer thread only. Plain load + store, there is only one writer.
+  void add(double seconds)
+  {
+    const int b = bucket(seconds);
+    mCounts[b].store(mCounts[b].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    mCount.store(mCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    const uint64_t ns = (uint64_t)(seconds * 1e9);
+    mTotalNs.store(mTotalNs.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+    if (ns > mMaxNs.load(std::memory_order_relaxed)) mMaxNs.store(ns, std::memory_order_relaxed);
+  }
+
+  uint64_t count() const { return mCount.load(std::memory_order_relaxed); }
+  double mean() const
+  {
+    uint64_t n = count();
+    return n ? mTotalNs.load(std::memory_order_relaxed) * 1e-9 / n : 0;
+  }
+  double max() const { return mMaxNs.load(std::memory_order_relaxed) * 1e-9; }
+
+  // Upper edge of the bucket holding the p-th fraction of samples
+  double percentile(double p) const
+  {
+    uint64_t counts[numBuckets], total = 0;
+    for (int b = 0; b < numBuckets; ++b) total += counts[b] = mCounts[b].load(std::memory_order_relaxed);
+    if (total == 0) return 0;
+    const uint64_t target = (uint64_t)std::ceil(p * total);
+    uint64_t seen = 0;
+    for (int b = 0; b < numBuckets; ++b) {
+      seen += counts[b];
+      if (seen >= target) return upperEdge(b);
+    }
+    return upperEdge(numBuckets - 1);
+  }
+
+private:
+  static int bucket(double seconds)
+  {
+    double us = seconds * 1e6;
+    if (us <= 1) return 0;
+    int b = (int)(std::log2(us) * 4) + 1;
+    return b < numBuckets ? b : numBuckets - 1;
+  }
+
+  static double upperEdge(int b) { return std::exp2(b / 4.0) * 1e-6; }
+
+  std::atomic<uint32_t> mCounts[numBuckets] = {};
+  std::atomic<uint64_t> mCount{0};
+  std::atomic<uint64_t> mTotalNs{0};
+  std::atomic<uint64_t> mMaxNs{0};
+};
+
+// Times the audio callback and its stages.
+//
+// The audio thread calls begin(), then lap(stage) after each stage, then
+// end(). Each lap is the time since the previous one. Everything is kept in
+// TimingHistograms and atomics so the GUI can read it while audio runs.
+class AudioTimer
+{
+public:
+  explicit AudioTimer(std::vector<std::string> stageNames)
+      : mNames(std::move(stageNames)), mStages(mNames.size()) {}
+
+  // Audio thread
+  void begin() { mStart = mLap = Clock::now(); }
+
+  void lap(int stage)
+  {
+    Clock::time_point now = Clock::now();
+    mStages[stage].add(std::chrono::duration<double>(now - mLap).count());
+    mLap = now;
+  }
+
+  // deadline: the length of the block in seconds. voices: how many were
+  // sounding during this block.
+  void end(double deadline, int voices)
+  {
+    double total = std::chrono::duration<double>(Clock::now() - mStart).count();
+    mTotal.add(total);
+    if (total > deadline)
+      mMisses.store(mMisses.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    mDeadline.store(deadline, std::memory_order_relaxed);
+    mVoices.store(voices, std::memory_order_relaxed);
+    if (voices > mMaxVoices.load(std::memory_order_relaxed))
+      mMaxVoices.store(voices, std::memory_order_relaxed);
+  }
+
+  // Any thread
+  int numStages() const { return (int)mNames.size(); }
+  const std::string &name(int stage) const { return mNames[stage]; }
+  const TimingHistogram &stage(int stage) const { return mStages[stage]; }
+  const TimingHistogram &total() const { return mTotal; }
+  uint64_t deadlineMisses() const { return mMisses.load(std::memory_order_relaxed); }
+  double deadline() const { return mDeadline.load(std::memory_order_relaxed); }
+  int voices() const { return mVoices.load(std::memory_order_relaxed); }
+  int maxVoices() const { return mMaxVoices.load(std::memory_order_relaxed); }
+
+  void dump(FILE *out) const
+  {
+    fprintf(out, "Audio callback: %llu blocks, %llu over the %.2f ms deadline, "
+                 "up to %d voices\n",
+            (unsigned long long)mTotal.count(), (unsigned long long)deadlineMisses(),
+            deadline() * 1e3, maxVoices());
+    fprintf(out, "  %-10s %9s %9s %9s %9s\n", "stage", "mean us", "p50 us", "p99 us", "max us");
+    for (int s = 0; s < numStages(); ++s) dumpLine(out, mNames[s], mStages[s]);
+    dumpLine(out, "total", mTotal);
+  }
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  static void dumpLine(FILE *out, const std::string &name, const TimingHistogram &h)
+  {
+    fprintf(out, "  %-10s %9.1f %9.1f %9.1f %9.1f\n", name.c_str(), h.mean() * 1e6,
+            h.percentile(0.5) * 1e6, h.percentile(0.99) * 1e6, h.max() * 1e6);
+  }
+
+  std::vector<std::string> mNames;
+  std::vector<TimingHistogram> mStages;
+  TimingHistogram mTotal;
+  Clock::time_point mStart, mLap;
+  std::atomic<uint64_t> mMisses{0};
+  std::atomic<double> mDeadline{0};
+  std::atomic<int> mVoices{0};
+  std::atomic<int> mMaxVoices{0};
+};
@@ -0,0 +1,220 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Precompiled mesh format written by objbake.cpp and read by MeshCache.
+//
+// File layout (native little-endian):
+//   BinaryMeshHeader
+//   BinaryMeshEntry[meshCount]
+//   per mesh: BinaryVertex[vertexCount], uint32_t[indexCount]
+//
+// Vertices are interleaved, deduplicated and indexed, and normals are already
+// computed, so loading is a mmap plus copying into al::Mesh.
+//
+// The full meshes come first, in file order, then any simplified levels of
+// detail objbake made of them: level 1 of every mesh that has one, then
+// level 2, and so on. Meshes that can't get any simpler have fewer levels.
+// Each entry says which level it is and which full mesh it simplifies.
+
+static const char kBinaryMeshMagic[4] = {'B', 'M', 'S', 'H'};
+static const uint32_t kBinaryMeshVersion = 3; // 2: levels of detail, 3: no material colors
+
+struct BinaryMeshHeader
+{
+  char magic[4];
+  uint32_t version;
+  uint64_t sourceSize;  // size of the OBJ this was baked from
+  int64_t sourceMTime;  // modification time of that OBJ
+  uint32_t meshCount;
+  uint32_t reserved;
+};
+
+struct BinaryMeshEntry
+{
+  char name[48];
+  uint32_t vertexCount;
+  uint32_t indexCount;
+  uint64_t vertexOffset; // bytes from start of file
+  uint64_t indexOffset;
+  uint32_t lod;          // 0 for the full mesh
+  uint32_t base;         // entry of the full mesh this is a level of
+  float cellSize;        // simplification grid spacing in mesh units, 0 at level 0
+  uint32_t reserved;
+};
+
+struct BinaryVertex
+{
+  float position[3];
+  float normal[3];
+  float texcoord[2];
+};
+
+// Size and modification time of a file, used to tell if a baked mesh is stale
+inline bool fileStamp(const std::string &path, uint64_t &size, int64_t &mtime)
+{
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) return false;
+  size = (uint64_t)st.st_size;
+  mtime = (int64_t)st.st_mtime;
+  return true;
+}
+
+// Read-only view of a whole file. Uses mmap where available, otherwise reads
+// the file into memory.
+class MappedFile
+{
+public:
+  MappedFile() {}
+  ~MappedFile() { close(); }
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  bool open(const std::string &path)
+  {
+    close();
+#ifndef _WIN32
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+      ::close(fd);
+      return false;
+    }
+    void *p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) return false;
+    mData = (const uint8_t *)p;
+    mSize = (size_t)st.st_size;
+    return true;
+#else
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f) return false;
+    fseek(f, 0, SEEK_END);
+    long n = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (n <= 0) {
+      fclose(f);
+      return false;
+    }
+    mFallback.resize((size_t)n);
+    size_t got = fread(mFallback.data(), 1, mFallback.size(), f);
+    fclose(f);
+    if (got != mFallback.size()) {
+      mFallback.clear();
+      return false;
+    }
+    mData = mFallback.data();
+    mSize = mFallback.size();
+    return true;
+#endif
+  }
+
+  void close()
+  {
+#ifndef _WIN32
+    if (mData) munmap((void *)mData, mSize);
+#else
+    mFallback.clear();
+#endif
+    mData = nullptr;
+    mSize = 0;
+  }
+
+  const uint8_t *data() const { return mData; }
+  size_t size() const { return mSize; }
+
+private:
+  const uint8_t *mData{nullptr};
+  size_t mSize{0};
+#ifdef _WIN32
+  std::vector<uint8_t> mFallback;
+#endif
+};
+
+// Validated view into a mapped .bmesh file, or into one packed in an asset
+// archive
+class BinaryMeshFile
+{
+public:
+  bool open(const std::string &path)
+  {
+    if (!mFile.open(path)) return false;
+    return view(mFile.data(), mFile.size(), path);
+  }
+
+  // Uses a .bmesh image someone else keeps alive. path is for messages.
+  bool view(const uint8_t *data, size_t size, const std::string &path)
+  {
+    mData = data;
+    mSize = size;
+    if (mSize < sizeof(BinaryMeshHeader)) return fail(path);
+    const BinaryMeshHeader &h = header();
+    if (memcmp(h.magic, kBinaryMeshMagic, 4) != 0 ||
+        h.version != kBinaryMeshVersion)
+      return fail(path);
+    size_t tableEnd =
+        sizeof(BinaryMeshHeader) + (size_t)h.meshCount * sizeof(BinaryMeshEntry);
+    if (tableEnd > mSize) return fail(path);
+    for (uint32_t i = 0; i < h.meshCount; i++) {
+      const BinaryMeshEntry &e = entry(i);
+      if (e.vertexOffset + (uint64_t)e.vertexCount * sizeof(BinaryVertex) > mSize ||
+          e.indexOffset + (uint64_t)e.indexCount * sizeof(uint32_t) > mSize ||
+          e.base >= h.meshCount)
+        return fail(path);
+    }
+    return true;
+  }
+
+  // True if the OBJ at sourcePath is missing or still matches what was baked
+  bool matchesSource(const std::string &sourcePath) const
+  {
+    uint64_t size;
+    int64_t mtime;
+    if (!fileStamp(sourcePath, size, mtime)) return true;
+    return size == header().sourceSize && mtime == header().sourceMTime;
+  }
+
+  const BinaryMeshHeader &header() const
+  {
+    return *(const BinaryMeshHeader *)mData;
+  }
+  uint32_t meshCount() const { return header().meshCount; }
+  const BinaryMeshEntry &entry(uint32_t i) const
+  {
+    return ((const BinaryMeshEntry *)(mData + sizeof(BinaryMeshHeader)))[i];
+  }
+  const BinaryVertex *vertices(uint32_t i) const
+  {
+    return (const BinaryVertex *)(mData + entry(i).vertexOffset);
+  }
+  const uint32_t *indices(uint32_t i) const
+  {
+    return (const uint32_t *)(mData + entry(i).indexOffset);
+  }
+
+private:
+  bool fail(const std::string &path)
+  {
+    printf("BinaryMesh: %s is not a valid mesh file\n", path.c_str());
+    mFile.close();
+    mData = nullptr;
+    mSize = 0;
+    return false;
+  }
+
+  MappedFile mFile; // when opened from a path
+  const uint8_t *mData = nullptr;
+  size_t mSize = 0;
+};
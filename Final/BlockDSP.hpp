@@ -0,0 +1,261 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+// Block based building blocks for the synth voices.
+//
+// Every stage works on a whole block at a time, writing into aligned scratch
+// buffers with plain loops over __restrict pointers so the compiler can
+// vectorize them. Only state that really is sequential (phase, envelope
+// position, follower) is carried from one block to the next.
+
+#if defined(_MSC_VER)
+#define BLOCK_RESTRICT __restrict
+#else
+#define BLOCK_RESTRICT __restrict__
+#endif
+
+static const int kBlockSize = 256; // frames rendered per inner pass
+
+// Fills ph[0..n) with the phase (0..1) of the next n samples
+inline void blockPhase(float *BLOCK_RESTRICT ph, int n, double &phase, float inc)
+{
+  const float start = (float)phase;
+  for (int i = 0; i < n; ++i) {
+    float p = start + (i + 1) * inc;
+    ph[i] = p - (float)(int)p;
+  }
+  phase += (double)n * inc;
+  phase -= std::floor(phase);
+}
+
+// Sine oscillator. Phase is folded into [-1/4, 1/4] of a cycle and fed to an
+// odd polynomial. The polynomial is good to about 1e-6; with the float phase
+// the output stays within 5e-5 of a double precision sine.
+class BlockSine
+{
+public:
+  void freq(float hz, double sampleRate) { mInc = (float)(hz / sampleRate); }
+
+  void render(float *BLOCK_RESTRICT out, int n)
+  {
+    blockPhase(out, n, mPhase, mInc);
+    for (int i = 0; i < n; ++i) {
+      float t = out[i] - 0.5f; // sin(2 pi p) = -sin(2 pi t)
+      float a = std::fabs(t);
+      a = std::min(a, 0.5f - a); // sin(pi - x) = sin(x)
+      float x = std::copysign(a, t) * 6.28318531f;
+      float x2 = x * x;
+      float s = x * (1.0f + x2 * (-1.66666672e-1f + x2 * (8.33332464e-3f +
+                x2 * (-1.98409706e-4f + x2 * 2.75565357e-6f))));
+      out[i] = -s;
+    }
+  }
+
+private:
+  double mPhase = 0;
+  float mInc = 0;
+};
+
+// Sawtooth with polyBLEP correction at the wrap, written without branches so
+// it vectorizes. Not the same algorithm as gam::Saw, but also band limited
+// and in the same -1..1 range.
+class BlockSaw
+{
+public:
+  void freq(float hz, double sampleRate) { mInc = (float)(hz / sampleRate); }
+
+  void render(float *BLOCK_RESTRICT out, int n)
+  {
+    blockPhase(out, n, mPhase, mInc);
+    const float dt = std::max(mInc, 1e-6f);
+    const float invDt = 1.0f / dt;
+    for (int i = 0; i < n; ++i) {
+      float p = out[i];
+      // Both corrections are zero outside one sample of the wrap, so they can
+      // be written as ramps clipped at zero, max(u, 0) = (u + |u|) / 2, which
+      // keeps the loop free of selects
+      float u = 1.0f - p * invDt;          // just after the wrap
+      float v = 1.0f - (1.0f - p) * invDt; // just before it
+      float a = 0.5f * (u + std::fabs(u));
+      float b = 0.5f * (v + std::fabs(v));
+      out[i] = 2 * p - 1 + a * a - b * b;
+    }
+  }
+
+private:
+  double mPhase = 0;
+  float mInc = 0;
+};
+
+// Linear ADSR with the same shape the voices used from gam::ADSR (curve 0,
+// levels 0 1 sustain 0, sustain point 2). Each segment is written as a ramp
+// so a block is a handful of vectorizable loops.
+class BlockADSR
+{
+public:
+  void attack(float s) { mAttack = std::max(s, 0.0f); }
+  void decay(float s) { mDecay = std::max(s, 0.0f); }
+  void sustain(float v) { mSustain = v; }
+  void release(float s) { mRelease = std::max(s, 0.0f); }
+
+  void reset()
+  {
+    mStage = ATTACK;
+    mValue = 0;
+    mStageLeft = -1;
+    mReleaseIn = -1;
+  }
+
+  void triggerRelease()
+  {
+    mReleaseIn = -1;
+    if (mStage == DONE) return;
+    mStage = RELEASE;
+    mStageLeft = -1;
+  }
+
+  // Starts the release after `frames` more samples have been rendered, so a
+  // note off can land anywhere inside a block
+  void releaseAfter(int frames) { mReleaseIn = std::max(frames, 0); }
+
+  bool done() const { return mStage == DONE; }
+  float value() const { return mValue; }
+
+  void render(float *BLOCK_RESTRICT out, int n, double sampleRate)
+  {
+    if (mReleaseIn >= 0 && mReleaseIn < n) {
+      const int before = mReleaseIn;
+      renderStages(out, before, sampleRate);
+      triggerRelease();
+      renderStages(out + before, n - before, sampleRate);
+      return;
+    }
+    if (mReleaseIn >= 0) mReleaseIn -= n;
+    renderStages(out, n, sampleRate);
+  }
+
+private:
+  enum Stage { ATTACK, DECAY, SUSTAIN, RELEASE, DONE };
+
+  void renderStages(float *BLOCK_RESTRICT out, int n, double sampleRate)
+  {
+    int i = 0;
+    while (i < n) {
+      if (mStage == SUSTAIN || mStage == DONE) {
+        const float v = mStage == SUSTAIN ? mSustain : 0.0f;
+        for (int k = i; k < n; ++k) out[k] = v;
+        mValue = v;
+        return;
+      }
+      if (mStageLeft < 0) beginStage(sampleRate);
+      const int count = std::min(n - i, mStageLeft);
+      const float start = mValue;
+      const float step = mStep;
+      float *BLOCK_RESTRICT o = out + i;
+      for (int k = 0; k < count; ++k) o[k] = start + (k + 1) * step;
+      mValue = start + count * step;
+      mStageLeft -= count;
+      i += count;
+      if (mStageLeft == 0) nextStage();
+    }
+  }
+
+  void beginStage(double sampleRate)
+  {
+    float seconds = 0, target = 0;
+    switch (mStage) {
+    case ATTACK: seconds = mAttack; target = 1; break;
+    case DECAY: seconds = mDecay; target = mSustain; break;
+    case RELEASE: seconds = mRelease; target = 0; break;
+    default: break;
+    }
+    mStageLeft = std::max(1, (int)(seconds * sampleRate + 0.5));
+    mStep = (target - mValue) / mStageLeft;
+  }
+
+  void nextStage()
+  {
+    mStageLeft = -1;
+    if (mStage == ATTACK) mStage = DECAY;
+    else if (mStage == DECAY) mStage = SUSTAIN;
+    else if (mStage == RELEASE) {
+      mStage = DONE;
+      mValue = 0;
+    }
+  }
+
+  float mAttack = 0.01f, mDecay = 0.1f, mSustain = 0.7f, mRelease = 1.0f;
+  Stage mStage = DONE;
+  float mValue = 0, mStep = 0;
+  int mStageLeft = -1;
+  int mReleaseIn = -1; // samples until a scheduled release, -1 for none
+};
+
+// Envelope follower updated once per block from the block's mean absolute
+// value, with the block-length equivalent of a 10 Hz one-pole smoother.
+// Only drives the graphics and the voice's free() check, so block rate is
+// plenty.
+class BlockEnvFollow
+{
+public:
+  float operator()(const float *BLOCK_RESTRICT in, int n, double sampleRate)
+  {
+    float sum = 0;
+    for (int i = 0; i < n; ++i) sum += std::fabs(in[i]);
+    const float mean = n > 0 ? sum / n : 0;
+    const float coef = 1.0f - (float)std::exp(-2 * M_PI * mFreq * n / sampleRate);
+    mValue += coef * (mean - mValue);
+    return mValue;
+  }
+  float value() const { return mValue; }
+
+private:
+  float mFreq = 10;
+  float mValue = 0;
+};
+
+// Equal power pan gains for pos in [-1, 1]
+inline void panGains(float pos, float &left, float &right)
+{
+  float theta = (std::min(std::max(pos, -1.0f), 1.0f) + 1) * (float)(M_PI / 4);
+  left = std::cos(theta);
+  right = std::sin(theta);
+}
+
+// One voice's signal path: oscillator * envelope * amp, follower, then
+// panned and added into the output channels.
+template <class Osc>
+class BlockVoice
+{
+public:
+  Osc osc;
+  BlockADSR env;
+  BlockEnvFollow follow;
+
+  // Renders `frames` samples and adds them into left/right
+  void render(float *BLOCK_RESTRICT left, float *BLOCK_RESTRICT right,
+              int frames, float amp, float pan, double sampleRate)
+  {
+    float gl, gr;
+    panGains(pan, gl, gr);
+    for (int done = 0; done < frames; done += kBlockSize) {
+      const int n = std::min(kBlockSize, frames - done);
+      osc.render(mSignal, n);
+      env.render(mEnv, n, sampleRate);
+      for (int i = 0; i < n; ++i) mSignal[i] *= mEnv[i] * amp;
+      follow(mSignal, n, sampleRate);
+      float *BLOCK_RESTRICT l = left + done;
+      float *BLOCK_RESTRICT r = right + done;
+      for (int i = 0; i < n; ++i) {
+        l[i] += mSignal[i] * gl;
+        r[i] += mSignal[i] * gr;
+      }
+    }
+  }
+
+private:
+  alignas(32) float mSignal[kBlockSize];
+  alignas(32) float mEnv[kBlockSize];
+};
@@ -0,0 +1,213 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "LockFree.hpp"
+
+// Seconds on a steady clock shared by every thread, for stamping commands
+inline double commandTime()
+{
+  using namespace std::chrono;
+  return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Maps commandTime() to audio frames, for input that arrives between blocks.
+// The audio thread calls tick() as each block starts; one other thread (the
+// TripleBuffer has a single reader) calls frameAt().
+//
+// Callbacks don't come exactly a block apart: the driver wakes the audio
+// thread late by a varying amount, sometimes two blocks back to back, so
+// taking each callback's time as its block's start is off by that jitter
+// (a few ms, 100+ frames). tick() runs the times through a delay locked loop
+// instead (F. Adriaensen, "Using a DLL to filter time"), a second order
+// filter that follows the steady block rate and the audio device's clock
+// drift, and hardly moves for one late callback. What's left is
+//   - a constant offset, the mean wakeup delay, which delays all input alike
+//   - a few frames of error; --self-test checks it stays under a tenth of a
+//     block with 3 ms of simulated jitter
+class AudioClock
+{
+public:
+  // frame: first frame of the block, frames: its length, time: commandTime()
+  // at the start of the callback
+  void tick(int64_t frame, int frames, double sampleRate, double time)
+  {
+    const double period = frames / sampleRate;
+    if (frame != mNextFrame || frames != mFrames || std::fabs(time - mNextTime) > kResync * period)
+    {
+      // First block, or audio restarted or stalled: start over from here
+      mStart = time;
+      mPeriod = period;
+      mNextTime = time + period;
+      mLocked = 0;
+    }
+    else
+    {
+      // Wide while it finds the rate, narrowing to ride out the jitter
+      mLocked += period;
+      const double bandwidth = std::max(kBandwidth, 1 / (1 + mLocked));
+      const double omega = 2 * 3.14159265358979 * bandwidth * period;
+      const double error = time - mNextTime;
+      mStart = mNextTime;
+      mNextTime += std::sqrt(2.0) * omega * error + mPeriod;
+      mPeriod += omega * omega * error;
+    }
+    mNextFrame = frame + frames;
+    mFrames = frames;
+    mPoints.back() = {mStart, frame, frames / mPeriod};
+    mPoints.publish();
+  }
+
+  // Frame the block clock was at at `time`, -1 before the first block
+  int64_t frameAt(double time)
+  {
+    const Point &p = mPoints.read();
+    if (p.frame < 0) return -1;
+    return p.frame + (int64_t)std::floor((time - p.time) * p.rate);
+  }
+
+private:
+  static constexpr double kBandwidth = 0.1; // Hz, how fast it follows a real change in rate
+  static constexpr double kResync = 4;      // blocks of error that mean the timing broke
+
+  struct Point
+  {
+    double time;  // filtered start of the block
+    int64_t frame;
+    double rate;  // frames per second of commandTime(), the device's real rate
+  };
+
+  // Audio thread
+  double mStart = 0, mPeriod = 0, mNextTime = 0;
+  double mLocked = 0; // seconds since the last resync
+  int64_t mNextFrame = -1;
+  int mFrames = 0;
+  TripleBuffer<Point> mPoints{Point{0, -1, 0}};
+};
+
+// Multiple producer / single consumer queue for sending commands to the
+// audio thread.
+//
+// Every producer thread gets its own lane, a wait-free SpscRing, so pushing
+// never waits on another producer. The consumer pops every lane into a
+// fixed scratch array and hands the commands over in timestamp order. T
+// needs a `double time` member. Lanes are fixed at construction and nothing
+// allocates afterwards.
+template <class T>
+class CommandQueue
+{
+public:
+  CommandQueue(int lanes, size_t capacityPerLane)
+  {
+    for (int i = 0; i < lanes; ++i) mLanes.emplace_back(new Lane(capacityPerLane));
+    mScratch.resize(lanes * mLanes[0]->ring.capacity());
+  }
+
+  int lanes() const { return (int)mLanes.size(); }
+
+  // Producer side, only ever called from the thread that owns `lane`.
+  // False if the lane is full and the command was dropped.
+  bool push(int lane, const T &command)
+  {
+    if (mLanes[lane]->ring.push(command)) return true;
+    mLanes[lane]->dropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  // Consumer side: calls apply(command) for everything pushed so far,
+  // oldest first
+  template <class F>
+  void drain(F &&apply)
+  {
+    size_t n = 0;
+    for (auto &lane : mLanes)
+      n += lane->ring.pop(mScratch.data() + n, mScratch.size() - n);
+    // Each lane is already in order, so this is only interleaving a few
+    // short runs
+    for (size_t i = 1; i < n; ++i) {
+      T c = mScratch[i];
+      size_t j = i;
+      for (; j > 0 && mScratch[j - 1].time > c.time; --j) mScratch[j] = mScratch[j - 1];
+      mScratch[j] = c;
+    }
+    for (size_t i = 0; i < n; ++i) apply(mScratch[i]);
+  }
+
+  // Commands dropped because a lane was full
+  size_t dropped() const
+  {
+    size_t n = 0;
+    for (auto &lane : mLanes) n += lane->dropped.load(std::memory_order_relaxed);
+    return n;
+  }
+
+private:
+  struct Lane
+  {
+    explicit Lane(size_t capacity) : ring(capacity) {}
+    SpscRing<T> ring;
+    std::atomic<size_t> dropped{0};
+  };
+
+  std::vector<std::unique_ptr<Lane>> mLanes; // by pointer, atomics can't move
+  std::vector<T> mScratch;
+};
+
+// Commands waiting on the audio thread for the sample they are due at.
+// T needs an `int64_t frame` member. Kept sorted in a fixed array, so
+// nothing allocates; if it fills up the latest command is dropped.
+template <class T, int Capacity>
+class PendingCommands
+{
+public:
+  bool insert(const T &command)
+  {
+    if (mCount == Capacity) {
+      mDropped.store(mDropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      return false;
+    }
+    int i = mCount++;
+    for (; i > 0 && mItems[i - 1].frame > command.frame; --i) mItems[i] = mItems[i - 1];
+    mItems[i] = command;
+    return true;
+  }
+
+  // Calls apply(command, offset) for every command due before
+  // blockStart + frames, oldest first. offset is the frame within the block,
+  // 0 for commands that are already late (counted in late()).
+  template <class F>
+  void release(int64_t blockStart, int frames, F &&apply)
+  {
+    int due = 0;
+    while (due < mCount && mItems[due].frame < blockStart + frames) ++due;
+    for (int i = 0; i < due; ++i) {
+      int64_t offset = mItems[i].frame - blockStart;
+      if (offset < 0) {
+        mLate.store(mLate.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        offset = 0;
+      }
+      apply(mItems[i], (int)offset);
+    }
+    for (int i = due; i < mCount; ++i) mItems[i - due] = mItems[i];
+    mCount -= due;
+  }
+
+  // Audio thread
+  int size() const { return mCount; }
+
+  // Any thread
+  uint64_t late() const { return mLate.load(std::memory_order_relaxed); }
+  uint64_t dropped() const { return mDropped.load(std::memory_order_relaxed); }
+
+private:
+  T mItems[Capacity];
+  int mCount = 0;
+  std::atomic<uint64_t> mLate{0};
+  std::atomic<uint64_t> mDropped{0};
+};
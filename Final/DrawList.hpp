@@ -0,0 +1,331 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "al/graphics/al_BufferObject.hpp"
+#include "al/graphics/al_Graphics.hpp"
+#include "al/graphics/al_Mesh.hpp"
+#include "al/graphics/al_Shader.hpp"
+#include "al/graphics/al_VAO.hpp"
+
+// Model matrix built the way Graphics builds one with translate / rotate /
+// scale, each step applied on the right, but on plain floats so a voice can
+// fill one in without touching the matrix stack. Column major, like GL.
+struct Transform
+{
+  float m[16] = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1};
+
+  Transform &translate(float x, float y, float z)
+  {
+    for (int r = 0; r < 3; ++r) m[12 + r] += m[r] * x + m[4 + r] * y + m[8 + r] * z;
+    return *this;
+  }
+
+  // degrees around axis, like Graphics::rotate
+  Transform &rotate(float degrees, float ax, float ay, float az)
+  {
+    const float len = std::sqrt(ax * ax + ay * ay + az * az);
+    if (len == 0) return *this;
+    ax /= len;
+    ay /= len;
+    az /= len;
+    const float a = degrees * (float)(M_PI / 180), c = std::cos(a), s = std::sin(a), t = 1 - c;
+    // Rotation matrix, column major
+    const float rot[9] = {t * ax * ax + c,      t * ax * ay + s * az, t * ax * az - s * ay,
+                          t * ax * ay - s * az, t * ay * ay + c,      t * ay * az + s * ax,
+                          t * ax * az + s * ay, t * ay * az - s * ax, t * az * az + c};
+    float cols[12];
+    for (int j = 0; j < 3; ++j)
+      for (int r = 0; r < 3; ++r)
+        cols[j * 4 + r] = m[r] * rot[j * 3] + m[4 + r] * rot[j * 3 + 1] + m[8 + r] * rot[j * 3 + 2];
+    for (int j = 0; j < 3; ++j)
+      for (int r = 0; r < 3; ++r) m[j * 4 + r] = cols[j * 4 + r];
+    return *this;
+  }
+
+  Transform &scale(float x, float y, float z)
+  {
+    for (int r = 0; r < 3; ++r) {
+      m[r] *= x;
+      m[4 + r] *= y;
+      m[8 + r] *= z;
+    }
+    return *this;
+  }
+};
+
+// Per frame list of mesh instances, drawn in as few calls as possible.
+//
+// Voices add() a mesh, a model matrix and a color from onProcess(Graphics&)
+// instead of drawing. draw() then buckets the records by mesh and lighting
+// (a counting sort, so the cost is linear in the number of voices), uploads
+// them as one instance buffer and issues one instanced draw per bucket with
+// its own shader. Meshes go to the GPU the first time they're drawn and
+// must not change or go away afterwards; the shared sphere levels and the
+// cached OBJ meshes never do.
+//
+// Lit batches are not shaded like Graphics::lighting. The shader below uses
+// a fixed headlight per vertex: 0.25 ambient plus 0.75 Lambert diffuse from
+// (0.3, 0.5, 1) in eye space. allolib's lighting shader works per fragment
+// from g's lights and material, specular included. So instanced voices look
+// flatter, have no highlight and ignore g.light(). direct(true) draws every
+// record through Graphics instead, one draw each with allolib's lighting, to
+// compare the two on screen.
+//
+// Graphics thread only. Nothing is allocated once the buffers have grown to
+// the largest frame.
+class DrawList
+{
+public:
+  static DrawList &instance()
+  {
+    static DrawList list;
+    return list;
+  }
+
+  void add(const al::Mesh &mesh, const Transform &transform, const al::Color &color, bool lit = true)
+  {
+    mRecords.push_back({batch(mesh, lit), transform, color});
+  }
+
+  // Draw through Graphics, one call per record, instead of instancing
+  void direct(bool on) { mDirect = on; }
+  bool direct() const { return mDirect; }
+
+  // What the last draw() drew
+  int instances() const { return mLastInstances; }
+  int batches() const { return mLastBatches; }
+  int64_t triangles() const { return mLastTriangles; }
+
+  // Draws everything added since the last call with g's view and
+  // projection (its model matrix is ignored), then empties the list
+  void draw(al::Graphics &g)
+  {
+    mLastBatches = 0;
+    mLastTriangles = 0;
+    mLastInstances = (int)mRecords.size();
+    if (mRecords.empty()) return;
+    if (mDirect) {
+      drawDirect(g);
+      return;
+    }
+    if (!mShaderReady) createShader();
+
+    // Counting sort into the instance buffer, bucket by bucket
+    const size_t numBatches = mBatches.size();
+    mStarts.assign(numBatches + 1, 0);
+    for (const Record &r : mRecords) ++mStarts[r.batch + 1];
+    for (size_t b = 0; b < numBatches; ++b) mStarts[b + 1] += mStarts[b];
+    mInstances.resize(mRecords.size());
+    mFill.assign(mStarts.begin(), mStarts.end() - 1);
+    for (const Record &r : mRecords) {
+      Instance &i = mInstances[mFill[r.batch]++];
+      std::copy(r.transform.m, r.transform.m + 16, i.model);
+      i.color[0] = r.color.r;
+      i.color[1] = r.color.g;
+      i.color[2] = r.color.b;
+      i.color[3] = r.color.a;
+    }
+
+    mInstanceBuffer.bind();
+    const size_t bytes = mInstances.size() * sizeof(Instance);
+    if (bytes > mInstanceCapacity) mInstanceCapacity = bytes * 2; // grow with headroom, then reuse
+    mInstanceBuffer.data(mInstanceCapacity, nullptr);              // orphan last frame's storage
+    mInstanceBuffer.subdata(0, (int)bytes, mInstances.data());
+
+    // Our program is bound behind Graphics' back and Graphics' own put back
+    // afterwards, so its idea of what's bound stays right
+    g.depthTesting(true);
+    al::ShaderProgram &previous = g.shader();
+    mShader.use();
+    mShader.uniform("view", g.viewMatrix());
+    mShader.uniform("projection", g.projMatrix());
+    for (size_t b = 0; b < numBatches; ++b) {
+      const int count = mStarts[b + 1] - mStarts[b];
+      if (count == 0) continue;
+      Batch &batch = *mBatches[b];
+      if (!batch.uploaded) upload(batch);
+      mShader.uniform("lit", batch.lit ? 1.0f : 0.0f);
+      batch.vao.bind();
+      pointInstances(batch, mStarts[b]);
+      if (batch.indexed)
+        glDrawElementsInstanced(batch.primitive, batch.count, GL_UNSIGNED_INT, nullptr, count);
+      else
+        glDrawArraysInstanced(batch.primitive, 0, batch.count, count);
+      batch.vao.unbind();
+      ++mLastBatches;
+      if (batch.primitive == GL_TRIANGLES) mLastTriangles += (int64_t)count * (batch.count / 3);
+    }
+    previous.use();
+    mRecords.clear();
+  }
+
+private:
+  // Attribute locations, shared with the shader below
+  enum { kPosition = 0, kNormal = 1, kModel = 2, kColor = 6 }; // kModel takes 2 to 5
+
+  struct Record
+  {
+    uint32_t batch;
+    Transform transform;
+    al::Color color;
+  };
+
+  struct Instance
+  {
+    float model[16];
+    float color[4];
+  };
+
+  // One mesh with one lighting state, and its vertex array
+  struct Batch
+  {
+    const al::Mesh *mesh;
+    bool lit;
+    bool uploaded = false;
+    bool indexed = false;
+    GLenum primitive = GL_TRIANGLES;
+    GLsizei count = 0;
+    al::VAO vao;
+    al::BufferObject positions, normals, indices;
+  };
+
+  void drawDirect(al::Graphics &g)
+  {
+    g.depthTesting(true);
+    for (const Record &r : mRecords) {
+      const Batch &batch = *mBatches[r.batch];
+      g.pushMatrix();
+      g.modelMatrix(al::Mat4f(r.transform.m));
+      g.lighting(batch.lit);
+      g.color(r.color);
+      g.draw(*batch.mesh);
+      g.popMatrix();
+      ++mLastBatches;
+      if (batch.mesh->primitive() == al::Mesh::TRIANGLES)
+        mLastTriangles += (int64_t)(batch.mesh->indices().empty() ? batch.mesh->vertices().size()
+                                                                  : batch.mesh->indices().size()) / 3;
+    }
+    g.lighting(false);
+    mRecords.clear();
+  }
+
+  uint32_t batch(const al::Mesh &mesh, bool lit)
+  {
+    // A handful of meshes at most, a scan beats hashing
+    lit = lit && !mesh.normals().empty();
+    for (size_t b = 0; b < mBatches.size(); ++b)
+      if (mBatches[b]->mesh == &mesh && mBatches[b]->lit == lit) return (uint32_t)b;
+    mBatches.emplace_back(new Batch{&mesh, lit});
+    return (uint32_t)mBatches.size() - 1;
+  }
+
+  void upload(Batch &b)
+  {
+    const al::Mesh &mesh = *b.mesh;
+    b.vao.create();
+    b.vao.bind();
+
+    b.positions.bufferType(GL_ARRAY_BUFFER);
+    b.positions.usage(GL_STATIC_DRAW);
+    b.positions.create();
+    b.positions.bind();
+    b.positions.data(mesh.vertices().size() * sizeof(al::Vec3f), mesh.vertices().data());
+    b.vao.enableAttrib(kPosition);
+    b.vao.attribPointer(kPosition, b.positions, 3);
+
+    if (!mesh.normals().empty()) {
+      b.normals.bufferType(GL_ARRAY_BUFFER);
+      b.normals.usage(GL_STATIC_DRAW);
+      b.normals.create();
+      b.normals.bind();
+      b.normals.data(mesh.normals().size() * sizeof(al::Vec3f), mesh.normals().data());
+      b.vao.enableAttrib(kNormal);
+      b.vao.attribPointer(kNormal, b.normals, 3);
+    }
+
+    b.indexed = !mesh.indices().empty();
+    if (b.indexed) {
+      b.indices.bufferType(GL_ELEMENT_ARRAY_BUFFER);
+      b.indices.usage(GL_STATIC_DRAW);
+      b.indices.create();
+      b.indices.bind(); // recorded in the vertex array
+      b.indices.data(mesh.indices().size() * sizeof(unsigned), mesh.indices().data());
+    }
+    b.count = (GLsizei)(b.indexed ? mesh.indices().size() : mesh.vertices().size());
+    b.primitive = (GLenum)mesh.primitive(); // Mesh primitives are the GL enums
+
+    for (int i = 0; i < 5; ++i) {
+      b.vao.enableAttrib(kModel + i); // model columns, then color
+      glVertexAttribDivisor(kModel + i, 1);
+    }
+    b.uploaded = true;
+  }
+
+  // Points the instance attributes of b's vertex array at its bucket
+  void pointInstances(Batch &b, int first)
+  {
+    const char *base = (const char *)(first * sizeof(Instance));
+    for (int c = 0; c < 4; ++c)
+      b.vao.attribPointer(kModel + c, mInstanceBuffer, 4, GL_FLOAT, GL_FALSE, sizeof(Instance),
+                          base + c * 4 * sizeof(float));
+    b.vao.attribPointer(kColor, mInstanceBuffer, 4, GL_FLOAT, GL_FALSE, sizeof(Instance),
+                        base + offsetof(Instance, color));
+  }
+
+  void createShader()
+  {
+    mShader.compile(R"(
+#version 330
+uniform mat4 view;
+uniform mat4 projection;
+uniform float lit;
+layout (location = 0) in vec3 position;
+layout (location = 1) in vec3 normal;
+layout (location = 2) in mat4 model;
+layout (location = 6) in vec4 color;
+out vec4 vColor;
+void main() {
+  mat4 modelView = view * model;
+  // Voices scale unevenly, so normals need the inverse transpose to stay
+  // perpendicular to the surface. The cofactor matrix is that times the
+  // determinant, which normalize() takes out, and it doesn't blow up when a
+  // voice is scaled flat.
+  mat3 m = mat3(modelView);
+  mat3 normalMatrix = mat3(cross(m[1], m[2]), cross(m[2], m[0]), cross(m[0], m[1]));
+  // Headlight from above and behind the camera, see the class comment
+  vec3 n = normalize(normalMatrix * normal + vec3(0, 0, 1e-6));
+  float diffuse = max(dot(n, normalize(vec3(0.3, 0.5, 1.0))), 0.0);
+  vColor = vec4(color.rgb * mix(1.0, 0.25 + 0.75 * diffuse, lit), color.a);
+  gl_Position = projection * modelView * vec4(position, 1.0);
+}
+)",
+                    R"(
+#version 330
+in vec4 vColor;
+layout (location = 0) out vec4 fragColor;
+void main() { fragColor = vColor; }
+)");
+    mInstanceBuffer.bufferType(GL_ARRAY_BUFFER);
+    mInstanceBuffer.usage(GL_STREAM_DRAW);
+    mInstanceBuffer.create();
+    mShaderReady = true;
+  }
+
+  std::vector<Record> mRecords;
+  std::vector<std::unique_ptr<Batch>> mBatches; // by pointer, GL objects can't be copied
+  std::vector<Instance> mInstances;
+  std::vector<int> mStarts, mFill;
+  al::ShaderProgram mShader;
+  al::BufferObject mInstanceBuffer;
+  size_t mInstanceCapacity = 0;
+  bool mShaderReady = false;
+  bool mDirect = false;
+  int mLastInstances = 0;
+  int mLastBatches = 0;
+  int64_t mLastTriangles = 0;
+};
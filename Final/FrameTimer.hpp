@@ -0,0 +1,133 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Build with -DFRAME_TIMERS=0 to compile the visual loop's timers out; the
+// scopes then expand to nothing and the graph isn't drawn.
+#ifndef FRAME_TIMERS
+#define FRAME_TIMERS 1
+#endif
+
+// CPU time of the stages of each visual frame, for the last numFrames frames.
+//
+// FRAME_TIMER_BEGIN once at the top of every frame (onAnimate), then a
+// FRAME_TIMER_SCOPE around each stage, in onAnimate or onDraw. A stage can
+// be timed more than once a frame, the times add up. Whatever isn't inside a
+// scope (buffer swap, vsync, allolib's own work) shows up as "other".
+//
+// This is CPU time on the graphics thread only. GL calls mostly just queue
+// work, so a draw stage is what it costs to submit, not what the GPU spends.
+// Graphics thread only, nothing is shared.
+class FrameTimer
+{
+  using Clock = std::chrono::steady_clock;
+
+public:
+  static const int numFrames = 240;
+
+  explicit FrameTimer(std::vector<std::string> stageNames)
+      : mNames(std::move(stageNames)), mTimes(numFrames * (mNames.size() + 1), 0.0f)
+  {
+  }
+
+  // Closes the previous frame and starts a new one
+  void beginFrame()
+  {
+    const Clock::time_point now = Clock::now();
+    if (mStarted) {
+      float *frame = row(mNewest);
+      float timed = 0;
+      for (int s = 0; s < numStages(); ++s) timed += frame[s];
+      const float total = ms(now - mFrameStart);
+      frame[numStages()] = std::max(0.0f, total - timed);
+      mCount = std::min(mCount + 1, numFrames - 1); // the last slot is the frame being timed
+    }
+    mStarted = true;
+    mFrameStart = now;
+    mNewest = (mNewest + 1) % numFrames;
+    std::fill(row(mNewest), row(mNewest) + numStages() + 1, 0.0f);
+  }
+
+  // Times one stage until it goes out of scope
+  class Scope
+  {
+  public:
+    Scope(FrameTimer &timer, int stage) : mTimer(timer), mStage(stage), mStart(Clock::now()) {}
+    ~Scope() { mTimer.row(mTimer.mNewest)[mStage] += ms(Clock::now() - mStart); }
+
+  private:
+    FrameTimer &mTimer;
+    int mStage;
+    Clock::time_point mStart;
+  };
+
+  // Stages, then "other"
+  int numStages() const { return (int)mNames.size(); }
+  const std::string &name(int stage) const { return mNames[stage]; }
+  // Finished frames kept, up to numFrames - 1
+  int frames() const { return mCount; }
+
+  // Milliseconds of `stage` (numStages() for "other") in finished frame i,
+  // 0 the oldest
+  float time(int i, int stage) const { return row(index(i))[stage]; }
+  float total(int i) const
+  {
+    float sum = 0;
+    for (int s = 0; s <= numStages(); ++s) sum += time(i, s);
+    return sum;
+  }
+
+  // Mean of a stage over the kept frames
+  float mean(int stage) const
+  {
+    float sum = 0;
+    for (int i = 0; i < mCount; ++i) sum += time(i, stage);
+    return mCount ? sum / mCount : 0;
+  }
+
+  // One line per kept frame, oldest first, all times in ms
+  bool writeCsv(const std::string &path) const
+  {
+    FILE *f = fopen(path.c_str(), "w");
+    if (!f) return false;
+    fprintf(f, "frame");
+    for (const std::string &n : mNames) fprintf(f, ",%s", n.c_str());
+    fprintf(f, ",other,total\n");
+    for (int i = 0; i < mCount; ++i) {
+      fprintf(f, "%d", i);
+      for (int s = 0; s <= numStages(); ++s) fprintf(f, ",%.4f", time(i, s));
+      fprintf(f, ",%.4f\n", total(i));
+    }
+    return fclose(f) == 0;
+  }
+
+private:
+  static float ms(Clock::duration d) { return std::chrono::duration<float, std::milli>(d).count(); }
+
+  float *row(int frame) { return &mTimes[frame * (mNames.size() + 1)]; }
+  const float *row(int frame) const { return &mTimes[frame * (mNames.size() + 1)]; }
+
+  // Ring slot of finished frame i; the newest slot is still being timed
+  int index(int i) const { return (mNewest - mCount + i + numFrames) % numFrames; }
+
+  std::vector<std::string> mNames;
+  std::vector<float> mTimes; // numFrames rows of stages + other
+  int mNewest = 0;           // frame being timed
+  int mCount = 0;
+  bool mStarted = false;
+  Clock::time_point mFrameStart;
+};
+
+#if FRAME_TIMERS
+#define FRAME_TIMER_CONCAT2(a, b) a##b
+#define FRAME_TIMER_CONCAT(a, b) FRAME_TIMER_CONCAT2(a, b)
+#define FRAME_TIMER_SCOPE(timer, stage) FrameTimer::Scope FRAME_TIMER_CONCAT(frameTimerScope, __LINE__)(timer, stage)
+#define FRAME_TIMER_BEGIN(timer) (timer).beginFrame()
+#else
+#define FRAME_TIMER_SCOPE(timer, stage) ((void)0)
+#define FRAME_TIMER_BEGIN(timer) ((void)0)
+#endif
@@ -0,0 +1,109 @@
+#pragma once
+
+// Chord, scale and melody grammar tables for NoteDecision, as flat constexpr
+// arrays indexed by chord id, so nothing is looked up by name or copied
+// when a decision is made.
+
+namespace harmony {
+
+constexpr int numChords = 8;
+constexpr int chordTones = 6;   // three notes, doubled an octave down
+constexpr int scaleLength = 15; // two octaves and a bit
+
+enum Chord { I, II, III, IV, V, V64, VI, VII };
+
+constexpr const char *chordNames[numChords] = {"i", "ii", "iii", "iv", "v", "v64", "vi", "vii"};
+
+//Self reminder add the 7th note
+//V and V 64 are same chord and needs update since previous code bass note is always root
+constexpr int chordNotes[numChords][chordTones] = {
+    {48, 52, 55, 36, 40, 43}, // C E G (C3 + C2) 1 maj
+    {50, 54, 57, 38, 42, 45}, // D F# A 2 maj
+    {52, 55, 59, 40, 43, 47}, // E G B 3 min
+    {54, 57, 60, 42, 45, 48}, // F# A C 4 min
+    {55, 59, 50, 43, 47, 38}, // G B D 5 maj
+    {50, 55, 59, 38, 43, 47}, // D G B 5 64 maj
+    {57, 60, 64, 45, 48, 52}, // A C E 6 min
+    {59, 62, 57, 47, 50, 45}  // B D A 7 dim
+};
+
+constexpr int scales[numChords][scaleLength] = {
+    {60, 62, 64, 65, 67, 69, 71, 72, 74, 76, 77, 79, 81, 83, 84}, // C major (Ionian)
+    {62, 64, 66, 67, 69, 71, 73, 74, 76, 78, 79, 81, 83, 85, 86}, // D major
+    {64, 66, 67, 69, 71, 73, 75, 76, 78, 79, 81, 83, 85, 87, 88}, // E minor
+    {66, 67, 69, 71, 72, 74, 76, 78, 79, 81, 83, 84, 86, 88, 90}, // F# minor
+    {67, 69, 71, 72, 74, 76, 78, 79, 81, 83, 84, 86, 88, 90, 91}, // G major
+    {62, 64, 66, 67, 69, 71, 73, 74, 76, 78, 79, 81, 83, 85, 86}, // D major (again)
+    {69, 71, 72, 74, 76, 78, 79, 81, 83, 84, 86, 88, 90, 91, 93}, // A minor
+    {71, 72, 74, 76, 78, 79, 81, 83, 84, 86, 88, 90, 91, 93, 95}  // B diminished (used like Locrian)
+};
+
+// Chance of moving from the row's chord to each column's chord
+constexpr float chordMarkov[numChords][numChords] = {
+    {0.0f, 0.32f, 0.19f, 0.05f, 0.1f, 0.04f, 0.26f, 0.04f},
+    {0.25f, 0.0f, 0.0f, 0.0f, 0.45f, 0.2f, 0.0f, 0.1f},
+    {0.0f, 0.4f, 0.0f, 0.0f, 0.0f, 0.0f, 0.6f, 0.0f},
+    {0.15f, 0.1f, 0.0f, 0.0f, 0.35f, 0.25f, 0.0f, 0.15f},
+    {0.7f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.3f, 0.0f},
+    {0.1f, 0.0f, 0.0f, 0.0f, 0.9f, 0.0f, 0.0f, 0.0f},
+    {0.0f, 0.5f, 0.0f, 0.0f, 0.5f, 0.0f, 0.0f, 0.0f},
+    {0.5f, 0.0f, 0.0f, 0.0f, 0.2f, 0.3f, 0.0f, 0.0f}
+};
+
+// Melody L-system, see LSystem.hpp. Both orders of each pair stand for a
+// shuffled expansion. Symbols 5 to 15 are terminal and index the chord's
+// scale.
+//
+// LSystem streams depth first, and the melody used to be expanded breadth
+// first: the 5/6 pair always came first, then the 7/8 and 9/10 pairs in
+// either order. So 0 has a single rule putting 1 first; shuffling it
+// would make half the melodies start on 7-10.
+constexpr const char *melodyGrammar =
+    "axiom: 0\n"
+    "0 -> 1 2\n"   // initial branching
+    "1 -> 5 6\n"   // terminal
+    "1 -> 6 5\n"
+    "2 -> 3 4\n"   // leads to terminals
+    "2 -> 4 3\n"
+    "3 -> 7 8\n"   // terminal
+    "3 -> 8 7\n"
+    "4 -> 9 10\n"  // terminal
+    "4 -> 10 9\n";
+constexpr int melodyDepth = 3; // every path reaches a terminal by then
+
+// Equal tempered frequency of every MIDI note, tuned to A = 432 Hz. Built
+// at compile time by stepping a semitone at a time away from A4.
+struct NoteFrequencies
+{
+  float hz[128];
+};
+
+constexpr NoteFrequencies makeNoteFrequencies()
+{
+  NoteFrequencies f{};
+  const double semitone = 1.0594630943592952646; // 2^(1/12)
+  double up = 432, down = 432;
+  for (int i = 0; i < 128 - 69; ++i, up *= semitone) f.hz[69 + i] = (float)up;
+  for (int i = 0; i <= 69; ++i, down /= semitone) f.hz[69 - i] = (float)down;
+  return f;
+}
+
+constexpr NoteFrequencies noteFrequencies = makeNoteFrequencies();
+
+inline float midiToFrequency(int note) { return noteFrequencies.hz[note & 127]; }
+
+static_assert(noteFrequencies.hz[81] > 863.99f && noteFrequencies.hz[81] < 864.01f,
+              "an octave above A4 should be 864 Hz");
+
+constexpr bool rowsSumToOne()
+{
+  for (int i = 0; i < numChords; ++i) {
+    float sum = 0;
+    for (int j = 0; j < numChords; ++j) sum += chordMarkov[i][j];
+    if (sum < 0.999f || sum > 1.001f) return false;
+  }
+  return true;
+}
+static_assert(rowsSumToOne(), "every chordMarkov row should sum to 1");
+
+} // namespace harmony
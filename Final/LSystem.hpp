@@ -0,0 +1,348 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// L-system with stochastic and parametric rules, expanded lazily.
+//
+// Rules are loaded from text, one per line:
+//
+//   axiom: A(1) B
+//   A(x) : x < 4 -> A(x+1) B(x*2)  @0.7   # guard, parameter math, weight
+//   A(x) -> B                       @0.3
+//   B -> A
+//
+// Symbols are names made of letters, digits and '_', each with one optional
+// float parameter. A successor's parameter is a number or the predecessor's
+// parameter with + - * / and numbers applied left to right (0 if left out).
+// Guards compare the parameter with a number (< <= > >=). Among the rules
+// whose guard passes, one is chosen by weight (default 1). Symbols with no
+// rule rewrite to themselves.
+//
+// expand() doesn't build the rewritten string. It walks it depth first with
+// an explicit stack of symbols still to be rewritten, and next() returns the
+// final symbols one at a time, in order. The stack only holds the pending
+// siblings along one path, at most depth * (longest successor list), so any
+// depth runs in a fixed amount of memory that is allocated by expand().
+class LSystem
+{
+public:
+  struct Symbol
+  {
+    int id;
+    float param;
+  };
+
+  // Parses rule text. Returns false, with a message in error(), on the first
+  // bad line; rules before it are kept.
+  bool load(const std::string &text)
+  {
+    mError.clear();
+    size_t start = 0;
+    int lineNumber = 0;
+    while (start <= text.size()) {
+      size_t end = text.find('\n', start);
+      if (end == std::string::npos) end = text.size();
+      std::string line = text.substr(start, end - start);
+      ++lineNumber;
+      size_t hash = line.find('#');
+      if (hash != std::string::npos) line.resize(hash);
+      if (!parseLine(line.c_str())) {
+        mError = "line " + std::to_string(lineNumber) + ": " + mError;
+        return false;
+      }
+      start = end + 1;
+    }
+    return true;
+  }
+
+  const std::string &error() const { return mError; }
+
+  // Id of a symbol name, added if it's new
+  int symbol(const std::string &name)
+  {
+    for (size_t i = 0; i < mNames.size(); ++i)
+      if (mNames[i] == name) return (int)i;
+    mNames.push_back(name);
+    mRulesBySymbol.emplace_back();
+    return (int)mNames.size() - 1;
+  }
+
+  const std::string &name(int id) const { return mNames[id]; }
+  int numSymbols() const { return (int)mNames.size(); }
+  const std::vector<Symbol> &axiom() const { return mAxiom; }
+
+  void seed(uint32_t s) { mRandom = s ? s : 1; }
+
+  // Starts streaming the axiom rewritten `depth` times
+  void expand(int depth) { expand(mAxiom.data(), (int)mAxiom.size(), depth); }
+
+  void expand(const Symbol *axiom, int count, int depth)
+  {
+    mDepth = depth;
+    mStack.clear();
+    mStack.reserve(count + (size_t)depth * mLongestRule);
+    for (int i = count - 1; i >= 0; --i) mStack.push_back({axiom[i], 0});
+  }
+
+  // Next symbol of the expanded string, false once it's all been returned
+  bool next(Symbol &out)
+  {
+    while (!mStack.empty()) {
+      Pending p = mStack.back();
+      mStack.pop_back();
+      const Rule *rule = p.depth < mDepth ? choose(p.symbol) : nullptr;
+      if (!rule) {
+        out = p.symbol;
+        return true;
+      }
+      for (int i = (int)rule->successors.size() - 1; i >= 0; --i) {
+        const Successor &s = rule->successors[i];
+        mStack.push_back({{s.id, s.scale * p.symbol.param + s.offset}, p.depth + 1});
+      }
+    }
+    return false;
+  }
+
+private:
+  enum Compare { None, Less, LessEqual, Greater, GreaterEqual };
+
+  // Successor parameter: scale * predecessor parameter + offset
+  struct Successor
+  {
+    int id;
+    float scale;
+    float offset;
+  };
+
+  struct Rule
+  {
+    Compare compare = None;
+    float threshold = 0;
+    float weight = 1;
+    std::vector<Successor> successors;
+  };
+
+  struct Pending
+  {
+    Symbol symbol;
+    int depth;
+  };
+
+  // Picks a rule for s among those whose guard passes, or nullptr
+  const Rule *choose(const Symbol &s)
+  {
+    const std::vector<int> &candidates = mRulesBySymbol[s.id];
+    if (candidates.empty()) return nullptr;
+    if (candidates.size() == 1 && mRules[candidates[0]].compare == None)
+      return &mRules[candidates[0]]; // deterministic, the common case
+    float total = 0;
+    for (int r : candidates)
+      if (passes(mRules[r], s.param)) total += mRules[r].weight;
+    if (total <= 0) return nullptr;
+    float pick = random() * total;
+    const Rule *last = nullptr;
+    for (int r : candidates) {
+      if (!passes(mRules[r], s.param)) continue;
+      last = &mRules[r];
+      pick -= last->weight;
+      if (pick < 0) break;
+    }
+    return last;
+  }
+
+  static bool passes(const Rule &r, float x)
+  {
+    switch (r.compare) {
+    case Less: return x < r.threshold;
+    case LessEqual: return x <= r.threshold;
+    case Greater: return x > r.threshold;
+    case GreaterEqual: return x >= r.threshold;
+    default: return true;
+    }
+  }
+
+  // xorshift32, uniform in [0, 1)
+  float random()
+  {
+    mRandom ^= mRandom << 13;
+    mRandom ^= mRandom >> 17;
+    mRandom ^= mRandom << 5;
+    return (mRandom >> 8) * (1.0f / 16777216.0f);
+  }
+
+  // Parsing, one line at a time. p always points at the next unread char.
+
+  static void skipSpace(const char *&p)
+  {
+    while (*p == ' ' || *p == '\t' || *p == '\r') ++p;
+  }
+
+  static bool isNameChar(char c)
+  {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+  }
+
+  bool fail(const char *message)
+  {
+    mError = message;
+    return false;
+  }
+
+  bool parseName(const char *&p, std::string &name)
+  {
+    skipSpace(p);
+    const char *begin = p;
+    while (isNameChar(*p)) ++p;
+    name.assign(begin, p);
+    return !name.empty();
+  }
+
+  bool parseNumber(const char *&p, float &value)
+  {
+    skipSpace(p);
+    char *end;
+    value = strtof(p, &end);
+    if (end == p) return false;
+    p = end;
+    return true;
+  }
+
+  // "(x)" after a predecessor: the variable name, empty if there's none
+  bool parseVariable(const char *&p, std::string &var)
+  {
+    var.clear();
+    skipSpace(p);
+    if (*p != '(') return true;
+    ++p;
+    if (!parseName(p, var)) return fail("expected a parameter name");
+    skipSpace(p);
+    if (*p != ')') return fail("expected ')'");
+    ++p;
+    return true;
+  }
+
+  // "(expression)" after a successor or axiom symbol, as scale * x + offset
+  bool parseExpression(const char *&p, const std::string &var, float &scale, float &offset)
+  {
+    scale = 0;
+    offset = 0;
+    skipSpace(p);
+    if (*p != '(') return true;
+    ++p;
+    skipSpace(p);
+    std::string name;
+    const char *save = p;
+    if (!var.empty() && parseName(p, name) && name == var) {
+      scale = 1;
+    } else {
+      p = save;
+      if (!parseNumber(p, offset)) return fail("expected a number or the parameter");
+    }
+    for (;;) {
+      skipSpace(p);
+      char op = *p;
+      if (op == ')') {
+        ++p;
+        return true;
+      }
+      if (op != '+' && op != '-' && op != '*' && op != '/') return fail("expected an operator or ')'");
+      ++p;
+      float v;
+      if (!parseNumber(p, v)) return fail("expected a number after an operator");
+      switch (op) {
+      case '+': offset += v; break;
+      case '-': offset -= v; break;
+      case '*': scale *= v; offset *= v; break;
+      case '/':
+        if (v == 0) return fail("division by zero");
+        scale /= v;
+        offset /= v;
+        break;
+      }
+    }
+  }
+
+  bool parseSymbols(const char *&p, const std::string &var, std::vector<Successor> &out)
+  {
+    out.clear();
+    for (;;) {
+      skipSpace(p);
+      if (!isNameChar(*p)) return true;
+      std::string name;
+      parseName(p, name);
+      Successor s{symbol(name), 0, 0};
+      if (!parseExpression(p, var, s.scale, s.offset)) return false;
+      out.push_back(s);
+    }
+  }
+
+  bool parseLine(const char *p)
+  {
+    skipSpace(p);
+    if (!*p) return true;
+
+    if (strncmp(p, "axiom:", 6) == 0) {
+      p += 6;
+      std::vector<Successor> symbols;
+      if (!parseSymbols(p, "", symbols)) return false;
+      mAxiom.clear();
+      for (const Successor &s : symbols) mAxiom.push_back({s.id, s.offset});
+      skipSpace(p);
+      return *p ? fail("unexpected text after the axiom") : true;
+    }
+
+    std::string name, var;
+    if (!parseName(p, name)) return fail("expected a symbol name");
+    if (!parseVariable(p, var)) return false;
+
+    Rule rule;
+    skipSpace(p);
+    if (*p == ':') {
+      ++p;
+      std::string guardVar;
+      if (!parseName(p, guardVar) || guardVar != var) return fail("a guard must test the parameter");
+      skipSpace(p);
+      if (p[0] == '<') rule.compare = p[1] == '=' ? LessEqual : Less;
+      else if (p[0] == '>') rule.compare = p[1] == '=' ? GreaterEqual : Greater;
+      else return fail("expected < <= > or >= in the guard");
+      p += (p[1] == '=') ? 2 : 1;
+      if (!parseNumber(p, rule.threshold)) return fail("expected a number in the guard");
+      skipSpace(p);
+    }
+
+    if (p[0] != '-' || p[1] != '>') return fail("expected '->'");
+    p += 2;
+    if (!parseSymbols(p, var, rule.successors)) return false;
+
+    skipSpace(p);
+    if (*p == '@') {
+      ++p;
+      if (!parseNumber(p, rule.weight) || rule.weight < 0) return fail("expected a weight after '@'");
+      skipSpace(p);
+    }
+    if (*p) return fail("unexpected text at the end of the rule");
+
+    int id = symbol(name);
+    mRules.push_back(rule);
+    mRulesBySymbol[id].push_back((int)mRules.size() - 1);
+    mLongestRule = std::max(mLongestRule, rule.successors.size());
+    return true;
+  }
+
+  std::vector<std::string> mNames;
+  std::vector<Rule> mRules;
+  std::vector<std::vector<int>> mRulesBySymbol; // symbol id -> indices into mRules
+  std::vector<Symbol> mAxiom;
+  size_t mLongestRule = 1;
+  std::string mError;
+
+  std::vector<Pending> mStack;
+  int mDepth = 0;
+  uint32_t mRandom = 0x9E3779B9u;
+};
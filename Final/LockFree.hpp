@@ -0,0 +1,104 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// Lock-free helpers for handing data between the audio thread and the rest of
+// the app. Nothing here allocates or blocks after construction.
+
+// Single producer / single consumer ring buffer. Both push and pop are
+// wait-free; push drops what doesn't fit instead of waiting for space.
+template <class T>
+class SpscRing
+{
+public:
+  // Capacity is rounded up to a power of two
+  explicit SpscRing(size_t capacity = 1024)
+  {
+    size_t n = 1;
+    while (n < capacity) n <<= 1;
+    mData.resize(n);
+    mMask = n - 1;
+  }
+
+  size_t capacity() const { return mData.size(); }
+
+  // Producer side. Returns how many items were written.
+  size_t push(const T *items, size_t count)
+  {
+    const size_t head = mHead.load(std::memory_order_relaxed);
+    const size_t tail = mTail.load(std::memory_order_acquire);
+    const size_t n = std::min(count, capacity() - (head - tail));
+    for (size_t i = 0; i < n; ++i) mData[(head + i) & mMask] = items[i];
+    mHead.store(head + n, std::memory_order_release);
+    return n;
+  }
+
+  bool push(const T &item) { return push(&item, 1) == 1; }
+
+  // Consumer side. Returns how many items were read.
+  size_t pop(T *items, size_t count)
+  {
+    const size_t tail = mTail.load(std::memory_order_relaxed);
+    const size_t head = mHead.load(std::memory_order_acquire);
+    const size_t n = std::min(count, head - tail);
+    for (size_t i = 0; i < n; ++i) items[i] = mData[(tail + i) & mMask];
+    mTail.store(tail + n, std::memory_order_release);
+    return n;
+  }
+
+  bool pop(T &item) { return pop(&item, 1) == 1; }
+
+  size_t size() const
+  {
+    return mHead.load(std::memory_order_acquire) -
+           mTail.load(std::memory_order_acquire);
+  }
+
+private:
+  std::vector<T> mData;
+  size_t mMask;
+  alignas(64) std::atomic<size_t> mHead{0};
+  alignas(64) std::atomic<size_t> mTail{0};
+};
+
+// Triple buffer for publishing the latest version of some data from one
+// thread to another. The writer always has a slot to write into and the
+// reader always sees a complete version, neither ever waits.
+template <class T>
+class TripleBuffer
+{
+public:
+  explicit TripleBuffer(const T &initial = T())
+      : mSlots{initial, initial, initial} {}
+
+  // Writer side: fill this, then publish()
+  T &back() { return mSlots[mBack]; }
+
+  void publish()
+  {
+    int old = mMiddle.exchange(mBack | kFresh, std::memory_order_acq_rel);
+    mBack = old & kIndex;
+  }
+
+  // Reader side: the newest published version
+  const T &read()
+  {
+    if (mMiddle.load(std::memory_order_relaxed) & kFresh) {
+      int old = mMiddle.exchange(mFront, std::memory_order_acq_rel);
+      mFront = old & kIndex;
+    }
+    return mSlots[mFront];
+  }
+
+private:
+  static const int kIndex = 3;
+  static const int kFresh = 4;
+
+  T mSlots[3];
+  int mBack = 0;
+  int mFront = 1;
+  std::atomic<int> mMiddle{2};
+};
@@ -0,0 +1,225 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Markov chain over states 0 .. states-1 with contexts of up to `order`
+// previous states.
+//
+// Transitions are stored sparsely, one row per context that was actually
+// seen, so large vocabularies and higher orders only cost what the corpus
+// uses. build() normalizes every row into a Walker alias table and indexes
+// the rows, directly by context when there are few enough possible contexts
+// and with a flat open addressing hash otherwise. After that sample() is one
+// lookup plus one table read, whatever the row's size, and allocates nothing.
+// Contexts that were never seen back off to shorter ones, down to the plain
+// state frequencies (order 0).
+//
+// bench.cpp times training and sampling against a linear cumulative scan.
+class MarkovModel
+{
+public:
+  // order is at most kMaxOrder, and the states of a full context have to fit
+  // in 56 bits
+  MarkovModel(int states, int order) : mStates(states), mOrder(order)
+  {
+    while ((1 << mBits) <= states) ++mBits;
+  }
+
+  int states() const { return mStates; }
+  int order() const { return mOrder; }
+
+  // Adds weight to context -> next. context holds `length` states, oldest
+  // first, with length <= order.
+  void add(const int *context, int length, int next, float weight = 1)
+  {
+    auto found = mIndex.emplace(key(context, length), (uint32_t)mRows.size());
+    if (found.second) mRows.emplace_back();
+    Row &row = mRows[found.first->second];
+    for (auto &c : row.counts) {
+      if (c.first == next) {
+        c.second += weight;
+        return;
+      }
+    }
+    row.counts.push_back({next, weight});
+  }
+
+  // Counts every transition in a progression, for every context length
+  // from 0 to order
+  void train(const int *sequence, int length)
+  {
+    for (int i = 0; i < length; ++i)
+      for (int k = 0; k <= mOrder && k <= i; ++k) add(sequence + i - k, k, sequence[i]);
+  }
+
+  // Builds the alias tables. Call again after adding more.
+  void build()
+  {
+    mEntries.clear();
+    std::vector<uint32_t> small, large;
+    std::vector<float> scaled;
+    for (Row &row : mRows) {
+      const uint32_t n = (uint32_t)row.counts.size();
+      row.first = (uint32_t)mEntries.size();
+      row.size = 0;
+      float total = 0;
+      for (auto &c : row.counts) total += c.second;
+      if (n == 0 || total <= 0) continue;
+      row.size = n;
+
+      // Vose's method: split the scaled weights into under- and over-full
+      // slots and top every under-full slot up from an over-full one
+      scaled.resize(n);
+      small.clear();
+      large.clear();
+      for (uint32_t i = 0; i < n; ++i) {
+        scaled[i] = row.counts[i].second * n / total;
+        (scaled[i] < 1 ? small : large).push_back(i);
+        int next = row.counts[i].first;
+        mEntries.push_back({1, next, next});
+      }
+      while (!small.empty() && !large.empty()) {
+        uint32_t s = small.back(), l = large.back();
+        small.pop_back();
+        mEntries[row.first + s].prob = scaled[s];
+        mEntries[row.first + s].alias = row.counts[l].first;
+        scaled[l] -= 1 - scaled[s];
+        if (scaled[l] < 1) {
+          large.pop_back();
+          small.push_back(l);
+        }
+      }
+      // Whatever is left is full up to rounding
+    }
+
+    // Small models: a row per possible context, in order of length
+    size_t possible = 0, power = 1;
+    for (int k = 0; k <= mOrder && possible <= kMaxDense; ++k, power *= mStates) {
+      mDenseStart[k] = possible;
+      possible += power;
+    }
+    mDense.clear();
+    if (possible <= kMaxDense) {
+      mDense.assign(possible, Slot{0, 0, 0});
+      for (auto &i : mIndex) {
+        const Row &row = mRows[i.second];
+        mDense[denseIndex(i.first)] = {i.first, row.first, row.size};
+      }
+      mSlots.clear();
+      return;
+    }
+
+    // Otherwise a hash table at most half full, so probes stay short
+    size_t slots = 16;
+    while (slots < 2 * mRows.size()) slots *= 2;
+    mSlots.assign(slots, Slot{kEmpty, 0, 0});
+    mShift = 64;
+    for (size_t n = slots; n > 1; n >>= 1) --mShift;
+    for (auto &i : mIndex) {
+      const Row &row = mRows[i.second];
+      if (row.size == 0) continue;
+      size_t h = hash(i.first);
+      while (mSlots[h].key != kEmpty) h = (h + 1) & (slots - 1);
+      mSlots[h] = {i.first, row.first, row.size};
+    }
+  }
+
+  // Next state after history (length states, oldest first), using the
+  // longest context that has data. u is uniform in [0, 1). Returns -1 if
+  // the model is empty.
+  int sample(const int *history, int length, float u) const
+  {
+    const size_t mask = mSlots.size() - 1;
+    for (int k = length < mOrder ? length : mOrder; k >= 0; --k) {
+      if (!mDense.empty()) {
+        size_t index = mDenseStart[k];
+        for (int i = 0, scale = 1; i < k; ++i, scale *= mStates) index += history[length - k + i] * scale;
+        const Slot &slot = mDense[index];
+        if (slot.size > 0) return pick(slot, u);
+        continue;
+      }
+      if (mSlots.empty()) return -1;
+      const uint64_t want = key(history + length - k, k);
+      for (size_t h = hash(want); mSlots[h].key != kEmpty; h = (h + 1) & mask) {
+        const Slot &slot = mSlots[h];
+        if (slot.key == want) return pick(slot, u);
+      }
+    }
+    return -1;
+  }
+
+  size_t numContexts() const { return mRows.size(); }
+
+private:
+  struct Row
+  {
+    std::vector<std::pair<int, float>> counts; // next state, weight
+    uint32_t first = 0;                        // into mEntries
+    uint32_t size = 0;
+  };
+
+  // One column of an alias table: keep `next` with probability prob, else
+  // take `alias`
+  struct Entry
+  {
+    float prob;
+    int next;
+    int alias;
+  };
+
+  struct Slot
+  {
+    uint64_t key;
+    uint32_t first; // into mEntries
+    uint32_t size;
+  };
+
+  static const uint64_t kEmpty = ~0ull; // no real key has every bit set
+  static const size_t kMaxDense = 1 << 16;
+  static const int kMaxOrder = 8;
+
+  int pick(const Slot &slot, float u) const
+  {
+    float x = u * slot.size;
+    uint32_t column = (uint32_t)x;
+    if (column >= slot.size) column = slot.size - 1;
+    const Entry &e = mEntries[slot.first + column];
+    return (x - column) < e.prob ? e.next : e.alias;
+  }
+
+  // Position of a key's context in mDense
+  size_t denseIndex(uint64_t k) const
+  {
+    int length = (int)(k >> 56);
+    size_t index = mDenseStart[length];
+    for (int i = 0, scale = 1; i < length; ++i, scale *= mStates)
+      index += ((k >> (i * mBits)) & ((1u << mBits) - 1)) * scale;
+    return index;
+  }
+
+  size_t hash(uint64_t k) const { return (size_t)((k * 0x9E3779B97F4A7C15ull) >> mShift); }
+
+  // Packs a context into one integer: its length in the top byte, then one
+  // bit field per state
+  uint64_t key(const int *context, int length) const
+  {
+    uint64_t k = (uint64_t)length << 56;
+    for (int i = 0; i < length; ++i) k |= (uint64_t)context[i] << (i * mBits);
+    return k;
+  }
+
+  int mStates;
+  int mOrder;
+  int mBits = 1; // enough for any state; mBits * order must stay under 56
+  std::unordered_map<uint64_t, uint32_t> mIndex; // context key -> mRows, for training
+  std::vector<Row> mRows;
+  std::vector<Entry> mEntries;
+  std::vector<Slot> mDense; // built from mIndex, for sampling small models
+  size_t mDenseStart[kMaxOrder + 1] = {};
+  std::vector<Slot> mSlots; // or large ones
+  int mShift = 60;
+};
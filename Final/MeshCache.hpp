@@ -0,0 +1,183 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "al/graphics/al_Mesh.hpp"
+#include "al_ext/assets3d/al_Asset.hpp"
+
+#include "AssetArchive.hpp"
+#include "BinaryMesh.hpp"
+
+// Process-wide cache for meshes imported from disk.
+// Every voice asking for the same file gets the same read-only copy, so a
+// file is parsed once no matter how many voices the PolySynth allocates.
+// Entries are reference counted: the meshes are released when the last
+// handle to them goes away.
+//
+// If a baked .bmesh (see objbake.cpp) sits next to the OBJ and was baked from
+// the current version of it, that is mapped instead of parsing the OBJ, and
+// brings simplified levels of detail of every mesh along. A copy packed in
+// the asset archive is used before either.
+class MeshCache
+{
+public:
+  // The meshes of a file, plus whatever levels of detail were baked for them
+  struct Meshes : std::vector<al::Mesh>
+  {
+    using std::vector<al::Mesh>::vector;
+
+    struct Level
+    {
+      al::Mesh mesh;
+      float cellSize; // simplification grid spacing, mesh units
+    };
+    // Per full mesh, level 1 first, coarser each time. Meshes that didn't
+    // simplify any further have fewer.
+    std::vector<std::vector<Level>> lods;
+
+    // Coarsest level of mesh i whose simplification cells are no bigger
+    // than maxCell (in mesh units), so at most the last one it has; the full
+    // mesh if none are
+    const al::Mesh &lod(size_t i, float maxCell) const
+    {
+      if (i >= lods.size()) return (*this)[i]; // loaded from the OBJ
+      const std::vector<Level> &levels = lods[i];
+      for (size_t l = levels.size(); l > 0; --l)
+        if (levels[l - 1].cellSize <= maxCell) return levels[l - 1].mesh;
+      return (*this)[i];
+    }
+  };
+  typedef std::shared_ptr<const Meshes> Handle;
+
+  static MeshCache &instance()
+  {
+    static MeshCache cache;
+    return cache;
+  }
+
+  // Returns the meshes in `path`, importing them only if nobody holds them yet.
+  // Returns nullptr if the file can't be read.
+  Handle get(const std::string &path)
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    Handle meshes = mEntries[path].lock();
+    if (meshes) return meshes;
+
+    auto start = std::chrono::steady_clock::now();
+    const char *source = "archive";
+    meshes = loadPacked(path);
+    if (!meshes) {
+      source = "binary";
+      meshes = loadBinary(path);
+    }
+    if (!meshes) {
+      source = "obj";
+      meshes = load(path);
+    }
+    if (!meshes) return nullptr;
+    double ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start).count();
+    printf("MeshCache: loaded %s (%d meshes) from %s in %.1f ms\n",
+           path.c_str(), (int)meshes->size(), source, ms);
+
+    mEntries[path] = meshes;
+    return meshes;
+  }
+
+  // Where objbake puts the baked copy of an OBJ
+  static std::string binaryPath(const std::string &path)
+  {
+    size_t dot = path.find_last_of('.');
+    size_t slash = path.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+      return path + ".bmesh";
+    return path.substr(0, dot) + ".bmesh";
+  }
+
+private:
+  MeshCache() {}
+
+  // The .bmesh packed in the asset archive, if there is one
+  static Handle loadPacked(const std::string &path)
+  {
+    AssetArchive::View packed = AssetArchive::instance().find(path, AssetType::Mesh);
+    BinaryMeshFile file;
+    if (!packed || !file.view(packed.data, packed.size, path) || !file.matchesSource(path)) return nullptr;
+    return fromBinary(file);
+  }
+
+  // Returns nullptr when there is no baked file or it is older than the OBJ,
+  // so the caller falls back to importing the OBJ
+  static Handle loadBinary(const std::string &path)
+  {
+    std::string bin = binaryPath(path);
+    BinaryMeshFile file;
+    if (!file.open(bin)) return nullptr;
+    if (!file.matchesSource(path)) {
+      printf("MeshCache: %s is stale, re-run objbake\n", bin.c_str());
+      return nullptr;
+    }
+    return fromBinary(file);
+  }
+
+  static Handle fromBinary(const BinaryMeshFile &file)
+  {
+    uint32_t full = 0;
+    while (full < file.meshCount() && file.entry(full).lod == 0) ++full;
+    auto meshes = std::make_shared<Meshes>(full);
+    meshes->lods.resize(full);
+    for (uint32_t i = 0; i < full; i++) copyMesh(file, i, (*meshes)[i]);
+    // Then the simplified levels, each pointing back at its full mesh, in
+    // order of level
+    for (uint32_t i = full; i < file.meshCount(); i++) {
+      const BinaryMeshEntry &e = file.entry(i);
+      if (e.base >= full) continue;
+      std::vector<Meshes::Level> &levels = meshes->lods[e.base];
+      if (e.lod != levels.size() + 1) continue;
+      levels.push_back({al::Mesh(), e.cellSize});
+      copyMesh(file, i, levels.back().mesh);
+    }
+    return meshes;
+  }
+
+  static void copyMesh(const BinaryMeshFile &file, uint32_t i, al::Mesh &m)
+  {
+    const BinaryMeshEntry &e = file.entry(i);
+    const BinaryVertex *v = file.vertices(i);
+    const uint32_t *idx = file.indices(i);
+    m.primitive(al::Mesh::TRIANGLES);
+    m.vertices().resize(e.vertexCount);
+    m.normals().resize(e.vertexCount);
+    m.texCoord2s().resize(e.vertexCount);
+    for (uint32_t k = 0; k < e.vertexCount; k++) {
+      m.vertices()[k] = al::Vec3f(v[k].position[0], v[k].position[1], v[k].position[2]);
+      m.normals()[k] = al::Vec3f(v[k].normal[0], v[k].normal[1], v[k].normal[2]);
+      m.texCoord2s()[k] = al::Vec2f(v[k].texcoord[0], v[k].texcoord[1]);
+    }
+    m.indices().assign(idx, idx + e.indexCount);
+  }
+
+  static Handle load(const std::string &path)
+  {
+    al::Scene *scene = al::Scene::import(path);
+    if (!scene) {
+      printf("error reading %s\n", path.c_str());
+      return nullptr;
+    }
+    auto meshes = std::make_shared<Meshes>(scene->meshes());
+    for (int i = 0; i < scene->meshes(); i += 1) {
+      scene->mesh(i, (*meshes)[i]);
+    }
+    delete scene;
+    return meshes;
+  }
+
+  std::mutex mMutex;
+  std::map<std::string, std::weak_ptr<const Meshes>> mEntries;
+};
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "al/math/al_Random.hpp"
+
+#include "HarmonyTables.hpp"
+#include "LSystem.hpp"
+#include "MarkovModel.hpp"
+
+// Picks chords and melodies from the tables in HarmonyTables.hpp. Nothing
+// here allocates after construction, results go into buffers owned by the
+// caller; `./bench decision` (bench.cpp) counts its allocations.
+class NoteDecision 
+{
+  public: 
+    static const int maxMelody = 16;
+
+    int currentChordIndex = 0; // Start on "i"
+
+    NoteDecision() {
+      if (!melodySystem.load(harmony::melodyGrammar))
+          std::cerr << "Melody grammar: " << melodySystem.error() << std::endl;
+      melodySystem.seed((uint32_t)(al::rnd::uniform() * 4294967295.0));
+      // Terminal symbols are named after their scale degree
+      for (int i = 0; i < melodySystem.numSymbols(); ++i)
+          symbolDegree.push_back(atoi(melodySystem.name(i).c_str()));
+
+      // First order chord model from the hand-written transition table
+      for (int from = 0; from < harmony::numChords; ++from)
+        for (int to = 0; to < harmony::numChords; ++to)
+          if (harmony::chordMarkov[from][to] > 0)
+            chordModel.add(&from, 1, to, harmony::chordMarkov[from][to]);
+      chordModel.build();
+    }
+
+    int pickNextChordIndex() {
+      int next = chordModel.sample(&currentChordIndex, 1, al::rnd::uniform());
+      return next >= 0 ? next : currentChordIndex; // fallback
+    }
+
+    // Moves to the next chord and writes two different random notes of it
+    void getNextHarmonyChord(int notes[2]) {
+      currentChordIndex = pickNextChordIndex();
+      int allNotes[harmony::chordTones];
+      for (int i = 0; i < harmony::chordTones; ++i)
+          allNotes[i] = harmony::chordNotes[currentChordIndex][i];
+
+      // Partial Fisher-Yates, stopping once two distinct notes are drawn
+      int selected = 0;
+      for (int i = 0; i < harmony::chordTones && selected < 2; ++i) {
+          int j = i + randomIndex(harmony::chordTones - i);
+          std::swap(allNotes[i], allNotes[j]);
+          if (selected == 0 || notes[0] != allNotes[i]) notes[selected++] = allNotes[i];
+      }
+
+      while (selected < 2) {
+          int filler = al::rnd::uniform(48, 72);
+          if (filler != notes[0]) notes[selected++] = filler;
+      }
+    }
+
+  // Streams the melody L-system for a chord and writes up to maxNotes MIDI
+  // notes from its scale into melody. Returns how many were written.
+  int generateLSystemMelody(int chord, int *melody, int maxNotes) {
+    melodySystem.expand(harmony::melodyDepth);
+    LSystem::Symbol symbol;
+    int count = 0;
+    while (count < maxNotes && melodySystem.next(symbol)) {
+        int degree = symbolDegree[symbol.id] % harmony::scaleLength; // safely wrap
+        melody[count++] = harmony::scales[chord][degree];
+    }
+
+    // Fallback
+    if (count == 0 && maxNotes > 0) {
+        melody[count++] = harmony::scales[chord][al::rnd::uniform(5, 16) % harmony::scaleLength]; // pick a terminal
+    }
+    return count;
+  }
+
+  private:
+    static int randomIndex(int n) { return std::min((int)(al::rnd::uniform() * n), n - 1); }
+
+    MarkovModel chordModel{harmony::numChords, 1};
+    LSystem melodySystem;
+    std::vector<int> symbolDegree; // by symbol id
+};
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+
+// Forward FFT of real input, for power-of-two sizes.
+//
+// The N real samples are packed into an N/2 point complex FFT (even samples
+// real, odd samples imaginary) and the result is split back into the N/2 + 1
+// bins of the real spectrum. Bit reversal indices and twiddles are computed
+// in the constructor; twiddles are stored per stage so every butterfly loop
+// reads them contiguously.
+class RealFFT
+{
+public:
+  explicit RealFFT(int size) : mSize(size), mHalf(size / 2)
+  {
+    int bits = 0;
+    while ((1 << bits) < mHalf) ++bits;
+    mBitrev.resize(mHalf);
+    for (int i = 0; i < mHalf; ++i) {
+      int r = 0;
+      for (int b = 0; b < bits; ++b) r |= ((i >> b) & 1) << (bits - 1 - b);
+      mBitrev[i] = r;
+    }
+
+    // Stage with span `half` uses twiddles[half - 1 .. 2 * half - 1)
+    mTwRe.resize(mHalf);
+    mTwIm.resize(mHalf);
+    for (int half = 1; half < mHalf; half *= 2) {
+      for (int j = 0; j < half; ++j) {
+        double a = -M_PI * j / half;
+        mTwRe[half - 1 + j] = (float)cos(a);
+        mTwIm[half - 1 + j] = (float)sin(a);
+      }
+    }
+
+    mSplitRe.resize(mHalf + 1);
+    mSplitIm.resize(mHalf + 1);
+    for (int k = 0; k <= mHalf; ++k) {
+      double a = -2 * M_PI * k / mSize;
+      mSplitRe[k] = (float)cos(a);
+      mSplitIm[k] = (float)sin(a);
+    }
+
+    mRe.resize(mHalf);
+    mIm.resize(mHalf);
+  }
+
+  int size() const { return mSize; }
+  int numBins() const { return mHalf + 1; }
+
+  // in: size() samples. re, im: numBins() values each, unnormalized.
+  void forward(const float *in, float *re, float *im)
+  {
+    float *zr = mRe.data();
+    float *zi = mIm.data();
+    for (int i = 0; i < mHalf; ++i) {
+      int r = mBitrev[i];
+      zr[r] = in[2 * i];
+      zi[r] = in[2 * i + 1];
+    }
+
+    for (int half = 1; half < mHalf; half *= 2) {
+      const float *wr = &mTwRe[half - 1];
+      const float *wi = &mTwIm[half - 1];
+      for (int start = 0; start < mHalf; start += 2 * half) {
+        float *ar = zr + start, *ai = zi + start;
+        float *br = ar + half, *bi = ai + half;
+        for (int j = 0; j < half; ++j) {
+          float tr = br[j] * wr[j] - bi[j] * wi[j];
+          float ti = br[j] * wi[j] + bi[j] * wr[j];
+          br[j] = ar[j] - tr;
+          bi[j] = ai[j] - ti;
+          ar[j] += tr;
+          ai[j] += ti;
+        }
+      }
+    }
+
+    // X[k] = (Z[k] + conj(Z[M-k])) / 2 - i W^k (Z[k] - conj(Z[M-k])) / 2
+    for (int k = 0; k <= mHalf; ++k) {
+      int a = k == mHalf ? 0 : k;
+      int b = k == 0 ? 0 : mHalf - k;
+      float er = 0.5f * (zr[a] + zr[b]);
+      float ei = 0.5f * (zi[a] - zi[b]);
+      float orr = 0.5f * (zi[a] + zi[b]);
+      float oi = -0.5f * (zr[a] - zr[b]);
+      re[k] = er + orr * mSplitRe[k] - oi * mSplitIm[k];
+      im[k] = ei + orr * mSplitIm[k] + oi * mSplitRe[k];
+    }
+  }
+
+private:
+  int mSize;
+  int mHalf;
+  std::vector<int> mBitrev;
+  std::vector<float> mTwRe, mTwIm;
+  std::vector<float> mSplitRe, mSplitIm;
+  std::vector<float> mRe, mIm;
+};
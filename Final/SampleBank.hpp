@@ -0,0 +1,142 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "AssetArchive.hpp"
+#include "al/sound/al_SoundFile.hpp"
+
+// Sound files decoded once into memory, stored as separate left and right
+// channels at the audio device's rate so playback is a plain copy.
+struct Sample
+{
+  std::string path;
+  const float *left = nullptr, *right = nullptr; // right is a copy of left for mono files
+  int frames = 0;
+  std::vector<float> storage; // left then right, unless they point into the asset archive
+};
+
+class SampleBank
+{
+public:
+  // Decodes a file, resampling to sampleRate if needed, or uses its packed
+  // copy when that was packed at sampleRate. Returns its index, or -1 if it
+  // couldn't be read. Call before audio starts.
+  int load(const std::string &path, double sampleRate)
+  {
+    SoundAssetHeader packed;
+    const float *left, *right;
+    if (AssetArchive::sound(AssetArchive::instance().find(path, AssetType::Sound), packed, left, right) &&
+        packed.sampleRate == (float)sampleRate) {
+      Sample s;
+      s.path = path;
+      s.left = left;
+      s.right = right;
+      s.frames = (int)packed.frames;
+      mSamples.push_back(std::move(s));
+      return (int)mSamples.size() - 1;
+    }
+
+    al::SoundFile file;
+    if (!file.open(path.c_str()) || file.frameCount <= 0 || file.channels <= 0) {
+      fprintf(stderr, "Could not load sample: %s\n", path.c_str());
+      return -1;
+    }
+
+    Sample s;
+    s.path = path;
+    const int channels = file.channels;
+    const int second = channels < 2 ? 0 : 1;
+    const double step = file.sampleRate > 0 ? file.sampleRate / sampleRate : 1.0;
+    s.frames = (int)((file.frameCount - 1) / step) + 1;
+    s.storage.resize(2 * (size_t)s.frames);
+    float *outLeft = s.storage.data(), *outRight = outLeft + s.frames;
+    // Linear interpolation, only ever run here
+    for (int i = 0; i < s.frames; ++i) {
+      double pos = i * step;
+      long long a = (long long)pos;
+      long long b = std::min(a + 1, file.frameCount - 1);
+      float t = (float)(pos - a);
+      const float *fa = &file.data[a * channels];
+      const float *fb = &file.data[b * channels];
+      outLeft[i] = fa[0] + t * (fb[0] - fa[0]);
+      outRight[i] = fa[second] + t * (fb[second] - fa[second]);
+    }
+    s.left = outLeft;
+    s.right = outRight; // the buffer moves along with s
+    mSamples.push_back(std::move(s));
+    return (int)mSamples.size() - 1;
+  }
+
+  int size() const { return (int)mSamples.size(); }
+  const Sample &operator[](int i) const { return mSamples[i]; }
+
+private:
+  std::vector<Sample> mSamples;
+};
+
+// Plays samples from a bank as overlapping one-shots.
+//
+// Voices come from a fixed pool; when they are all busy the one that has
+// played the longest is restarted. Everything here runs on the audio thread,
+// other threads ask for samples through the app's command queue.
+class OneShotPlayer
+{
+public:
+  static const int maxVoices = 32;
+
+  explicit OneShotPlayer(const SampleBank &bank) : mBank(bank) {}
+
+  void start(int sample, float gain = 1.0f)
+  {
+    if (sample < 0 || sample >= mBank.size()) return;
+    Voice *slot = &mVoices[0];
+    for (Voice &v : mVoices) {
+      if (!v.sample) {
+        slot = &v;
+        break;
+      }
+      if (v.position > slot->position) slot = &v;
+    }
+    slot->sample = &mBank[sample];
+    slot->position = 0;
+    slot->gain = gain;
+  }
+
+  // Adds every sounding voice into left and right
+  void render(float *left, float *right, int frames)
+  {
+    for (Voice &v : mVoices) {
+      if (!v.sample) continue;
+      const int n = std::min(frames, v.sample->frames - v.position);
+      const float *l = v.sample->left + v.position;
+      const float *r = v.sample->right + v.position;
+      for (int i = 0; i < n; ++i) {
+        left[i] += v.gain * l[i];
+        right[i] += v.gain * r[i];
+      }
+      v.position += n;
+      if (v.position >= v.sample->frames) v.sample = nullptr;
+    }
+  }
+
+  int activeVoices() const
+  {
+    int n = 0;
+    for (const Voice &v : mVoices) n += v.sample != nullptr;
+    return n;
+  }
+
+private:
+  struct Voice
+  {
+    const Sample *sample = nullptr;
+    int position = 0;
+    float gain = 1;
+  };
+
+  const SampleBank &mBank;
+  Voice mVoices[maxVoices];
+};
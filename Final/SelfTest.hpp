@@ -0,0 +1,93 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <set>
+#include <vector>
+
+#include "CommandQueue.hpp"
+#include "HarmonyTables.hpp"
+#include "NoteDecision.hpp"
+
+// The checks `--self-test` runs that don't need the app: each prints one
+// line and returns false on failure. The ones that drive MyApp's voices stay
+// in main.cpp.
+struct SelfTest
+{
+  // AudioClock against callbacks that come up to 3 ms late, and 5 ms late
+  // every 50th block, from a device running a little fast. Past the first
+  // few seconds frameAt() has to stay within a tenth of a block of the true
+  // frame, give or take its constant offset (the mean lateness).
+  static bool checkClockError()
+  {
+    const int frames = 512;
+    const double rate = 48000 * 1.0001, start = 1000;
+    AudioClock clock;
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<double> late(0, 0.003);
+    std::vector<double> errors;
+    for (int b = 0; b < 20 * 48000 / frames; ++b)
+    {
+      const double ideal = start + b * frames / rate;
+      const double t = ideal + late(rng) + (b % 50 == 0 ? 0.005 : 0);
+      clock.tick((int64_t)b * frames, frames, 48000, t);
+      if (b < 3 * 48000 / frames) continue;
+      // Input arriving anywhere in the block
+      for (double in = t; in < ideal + frames / rate; in += 0.001)
+        errors.push_back(clock.frameAt(in) - (in - start) * rate);
+    }
+    double mean = 0;
+    for (double e : errors) mean += e / errors.size();
+    double worst = 0;
+    for (double e : errors) worst = std::max(worst, std::fabs(e - mean));
+
+    const bool ok = worst < frames / 10;
+    printf("  audio clock: %.0f frames behind, within %.1f frames of that (limit %d)\n", -mean, worst,
+           frames / 10);
+    return ok;
+  }
+
+  // The streamed melody L-system against the breadth first expansion it
+  // replaced: every melody has to be one the old code could make, and
+  // every one of those has to come up
+  static bool checkMelodyOrder()
+  {
+    // The old generator, with its shuffles taken from the bits of `choices`
+    auto oldMelody = [](int choices) {
+      const int rules[5][2] = {{1, 2}, {5, 6}, {3, 4}, {7, 8}, {9, 10}};
+      std::vector<int> queue{0}, degrees;
+      for (size_t head = 0; head < queue.size(); ++head)
+      {
+        const int s = queue[head];
+        if (s >= 5) { degrees.push_back(s); continue; }
+        const int first = (choices >> s) & 1;
+        queue.push_back(rules[s][first]);
+        queue.push_back(rules[s][1 - first]);
+      }
+      return degrees;
+    };
+    std::set<std::vector<int>> possible, seen;
+    for (int choices = 0; choices < 32; ++choices) possible.insert(oldMelody(choices));
+
+    NoteDecision decision;
+    int notes[NoteDecision::maxMelody];
+    int strays = 0;
+    for (int i = 0; i < 2000; ++i)
+    {
+      const int count = decision.generateLSystemMelody(0, notes, NoteDecision::maxMelody);
+      std::vector<int> degrees;
+      for (int n = 0; n < count; ++n)
+        for (int d = 0; d < harmony::scaleLength; ++d)
+          if (harmony::scales[0][d] == notes[n] && d >= 5) { degrees.push_back(d); break; }
+      if (possible.count(degrees)) seen.insert(degrees);
+      else ++strays;
+    }
+
+    const bool ok = strays == 0 && seen.size() == possible.size();
+    printf("  melody order: %d of %d old melodies seen, %d new ones\n", (int)seen.size(),
+           (int)possible.size(), strays);
+    return ok;
+  }
+};
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "FastMath.hpp"
+
+// tanh soft clipper for the master bus.
+//
+// Processes whole buffers, every channel in one call, with the branch-free
+// fastTanh from FastMath.hpp (absolute error < 6e-6 against std::tanh, about
+// -104 dB). Optionally runs the nonlinearity at twice the sample rate, with
+// halfband filters either side, to keep the harmonics it adds from aliasing.
+class SoftClipper
+{
+public:
+  static const int halfbandTaps = 47;
+
+  // Allocates all the buffers, call before audio starts
+  void setup(int channels, int maxFrames)
+  {
+    mChannels = channels;
+    mMaxFrames = maxFrames;
+    mUpIn.assign(channels, std::vector<float>(kHistory + maxFrames, 0.0f));
+    mDownIn.assign(channels, std::vector<float>(halfbandTaps - 1 + 2 * maxFrames, 0.0f));
+    mAcc.assign(maxFrames, 0.0f);
+    design();
+  }
+
+  void oversample(bool on) { mOversample = on; }
+  bool oversample() const { return mOversample; }
+
+  // Clips frames samples of each of the channels in place
+  void process(float *const *channels, int numChannels, int frames)
+  {
+    bool over = mOversample.load(std::memory_order_relaxed);
+    if (over != mWasOversampling) {
+      reset();
+      mWasOversampling = over;
+    }
+    numChannels = std::min(numChannels, mChannels);
+    for (int done = 0; done < frames; done += mMaxFrames) {
+      int n = std::min(mMaxFrames, frames - done);
+      for (int c = 0; c < numChannels; ++c) {
+        float *x = channels[c] + done;
+        if (over) processOversampled(c, x, n);
+        else clip(x, n);
+      }
+    }
+  }
+
+  static void clip(float *x, int n)
+  {
+    for (int i = 0; i < n; ++i) x[i] = fastTanh(x[i]);
+  }
+
+private:
+  // Input history the upsampler needs, in input-rate samples
+  static const int kHistory = (halfbandTaps - 1) / 2;
+
+  // Windowed-sinc halfband lowpass with its center at tap kHistory (odd).
+  // Taps at an even distance from the center are zero, apart from the
+  // center itself (0.5), so only the odd-distance taps at indices 0, 2, 4 ..
+  // are stored.
+  void design()
+  {
+    mTaps.clear();
+    for (int k = 0; k < halfbandTaps; k += 2) {
+      int d = k - kHistory;
+      double sinc = sin(M_PI * d / 2) / (M_PI * d);
+      double w = 0.42 - 0.5 * cos(2 * M_PI * k / (halfbandTaps - 1)) +
+                 0.08 * cos(4 * M_PI * k / (halfbandTaps - 1)); // Blackman
+      mTaps.push_back((float)(sinc * w));
+    }
+    // These taps make up one polyphase branch, which should have a DC gain of
+    // exactly 0.5 like the center tap
+    float sum = 0;
+    for (float t : mTaps) sum += t;
+    for (float &t : mTaps) t *= 0.5f / sum;
+  }
+
+  void reset()
+  {
+    for (auto &h : mUpIn) std::fill(h.begin(), h.end(), 0.0f);
+    for (auto &h : mDownIn) std::fill(h.begin(), h.end(), 0.0f);
+  }
+
+  // The filters loop over taps on the outside and samples on the inside, so
+  // the inner loops vectorize without reassociating float sums.
+  void processOversampled(int c, float *x, int n)
+  {
+    const int taps = (int)mTaps.size();
+    float *acc = mAcc.data();
+    float *in = mUpIn[c].data();
+    float *v = mDownIn[c].data();
+    float *up = v + halfbandTaps - 1;
+    memcpy(in + kHistory, x, n * sizeof(float));
+
+    // Upsample by 2. Even outputs are the stored taps run over the input,
+    // odd outputs only hit the center tap, so they are the input delayed.
+    for (int i = 0; i < n; ++i) acc[i] = 0;
+    for (int j = 0; j < taps; ++j) {
+      const float h = 2 * mTaps[j];
+      const float *src = in + kHistory - j;
+      for (int i = 0; i < n; ++i) acc[i] += h * src[i];
+    }
+    const float *delayed = in + kHistory - (kHistory - 1) / 2;
+    for (int i = 0; i < n; ++i) {
+      up[2 * i] = acc[i];
+      up[2 * i + 1] = delayed[i];
+    }
+
+    clip(up, 2 * n);
+
+    // Same halfband again, evaluated only at every other sample
+    const float *newest = up + 1; // output i ends at up[2i + 1]
+    for (int i = 0; i < n; ++i) acc[i] = 0.5f * newest[2 * i - kHistory];
+    for (int j = 0; j < taps; ++j) {
+      const float h = mTaps[j];
+      const float *src = newest - 2 * j;
+      for (int i = 0; i < n; ++i) acc[i] += h * src[2 * i];
+    }
+    memcpy(x, acc, n * sizeof(float));
+
+    // Keep the tails for the next block
+    memmove(in, in + n, kHistory * sizeof(float));
+    memmove(v, v + 2 * n, (halfbandTaps - 1) * sizeof(float));
+  }
+
+  int mChannels = 0;
+  int mMaxFrames = 0;
+  std::vector<float> mTaps;
+  std::vector<float> mAcc;
+  std::vector<std::vector<float>> mUpIn, mDownIn;
+  std::atomic<bool> mOversample{false};
+  bool mWasOversampling = false;
+};
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "al/graphics/al_Graphics.hpp"
+#include "al/graphics/al_Texture.hpp"
+#include "al/graphics/al_VAOMesh.hpp"
+
+// Spectrum display with a scrolling waterfall of the last `rows` spectra.
+// Levels are drawn relative to `reference`: a bin at the reference level is
+// one unit tall and green, and colors go from cyan at silence to red at four
+// times the reference.
+//
+// Everything is allocated in init(). The current spectrum is a line strip
+// whose vertices and colors are rewritten in place; the history is a
+// bins x rows texture used as a ring, where only the newest row is uploaded
+// and scrolling is done by offsetting the quad's texture coordinates.
+class Spectrogram
+{
+public:
+  void init(int bins, int rows, float reference)
+  {
+    mBins = bins;
+    mReference = reference;
+    mRows = rows;
+    mHead = 0;
+
+    mLine.reset();
+    mLine.primitive(al::Mesh::LINE_STRIP);
+    for (int i = 0; i < bins; i++) {
+      mLine.vertex(i, 0, 0);
+      mLine.color(al::HSV(0.5));
+    }
+    mLine.update();
+
+    mRow.assign(bins * 4, 0);
+    std::vector<uint8_t> blank(bins * rows * 4, 0);
+    mHistory.create2D(bins, rows, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);
+    mHistory.filter(GL_LINEAR);
+    mHistory.wrap(GL_REPEAT);
+    mHistory.submit(blank.data(), GL_RGBA, GL_UNSIGNED_BYTE);
+
+    mWaterfall.reset();
+    mWaterfall.primitive(al::Mesh::TRIANGLE_STRIP);
+    mWaterfall.vertex(0, -1, 0);
+    mWaterfall.vertex(1, -1, 0);
+    mWaterfall.vertex(0, 0, 0);
+    mWaterfall.vertex(1, 0, 0);
+    for (int i = 0; i < 4; i++) mWaterfall.texCoord(0, 0);
+    scroll();
+  }
+
+  int bins() const { return mBins; }
+
+  // Writes a new spectrum: the line's heights and colors, and one new row of
+  // the waterfall
+  void update(const std::vector<float> &spectrum)
+  {
+    int n = std::min(mBins, (int)spectrum.size());
+    auto &vertices = mLine.vertices();
+    auto &colors = mLine.colors();
+    for (int i = 0; i < n; i++) {
+      float level = spectrum[i] / mReference;
+      al::Color c = al::HSV(0.5f - 0.125f * std::min(level, 4.0f));
+      vertices[i][1] = level;
+      colors[i] = c;
+      mRow[i * 4 + 0] = (uint8_t)(std::min(std::max(c.r, 0.0f), 1.0f) * 255);
+      mRow[i * 4 + 1] = (uint8_t)(std::min(std::max(c.g, 0.0f), 1.0f) * 255);
+      mRow[i * 4 + 2] = (uint8_t)(std::min(std::max(c.b, 0.0f), 1.0f) * 255);
+      mRow[i * 4 + 3] = 255;
+    }
+    mLine.update();
+
+    mHead = (mHead + 1) % mRows;
+    mHistory.bind();
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, mHead, mBins, 1, GL_RGBA,
+                    GL_UNSIGNED_BYTE, mRow.data());
+    mHistory.unbind();
+    scroll();
+  }
+
+  // Line in bin units (x) by level (y)
+  void drawLine(al::Graphics &g) { g.draw(mLine); }
+
+  // Waterfall over the unit square below the origin, newest row on top
+  void drawWaterfall(al::Graphics &g)
+  {
+    mHistory.bind();
+    g.texture();
+    g.draw(mWaterfall);
+    mHistory.unbind();
+  }
+
+private:
+  // Points the quad's texture coordinates at the ring so the newest row is at
+  // the top edge; the texture repeats so the wrap point is seamless
+  void scroll()
+  {
+    float top = (mHead + 0.5f) / mRows;
+    float bottom = top - 1.0f;
+    auto &tc = mWaterfall.texCoord2s();
+    tc[0] = al::Vec2f(0, bottom);
+    tc[1] = al::Vec2f(1, bottom);
+    tc[2] = al::Vec2f(0, top);
+    tc[3] = al::Vec2f(1, top);
+    mWaterfall.update();
+  }
+
+  int mBins = 0;
+  int mRows = 0;
+  int mHead = 0;
+  float mReference = 1;
+  al::VAOMesh mLine;
+  al::VAOMesh mWaterfall;
+  al::Texture mHistory;
+  std::vector<uint8_t> mRow;
+};
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "FastMath.hpp"
+#include "LockFree.hpp"
+#include "RealFFT.hpp"
+
+// Runs the spectrum analysis on its own thread.
+// The audio thread only copies its output into a ring buffer; the worker
+// drains the ring, runs a Hann windowed real FFT every size / 4 samples and
+// publishes each new spectrum through a triple buffer that the graphics
+// thread reads without locking.
+class SpectrumAnalyzer
+{
+public:
+  static const int minSize = 1024;
+  static const int maxSize = 16384;
+
+  SpectrumAnalyzer() : mSamples(1 << 16) {}
+  ~SpectrumAnalyzer() { stop(); }
+
+  // fftSize is rounded to a power of two in [minSize, maxSize].
+  // Not safe to call while another thread reads spectrum().
+  void start(int fftSize)
+  {
+    stop();
+    int n = minSize;
+    while (n < fftSize && n < maxSize) n *= 2;
+    mFFT.reset(new RealFFT(n));
+    mHop = n / 4;
+    mWindow.resize(n);
+    float sum = 0;
+    for (int i = 0; i < n; ++i) {
+      mWindow[i] = 0.5f - 0.5f * (float)cos(2 * M_PI * i / n);
+      sum += mWindow[i];
+    }
+    // A sine of amplitude A comes out as A / 2
+    mNorm = 1.0f / sum;
+    mInput.assign(n, 0.0f);
+    mWindowed.resize(n);
+    mRe.resize(mFFT->numBins());
+    mIm.resize(mFFT->numBins());
+    mFill = 0;
+    mSpectra.reset(new TripleBuffer<std::vector<float>>(std::vector<float>(mFFT->numBins())));
+    mRunning = true;
+    mThread = std::thread([this]() { run(); });
+  }
+
+  void stop()
+  {
+    mRunning = false;
+    if (mThread.joinable()) mThread.join();
+  }
+
+  // Audio thread: never blocks, drops samples if the worker falls behind
+  void push(const float *samples, int count)
+  {
+    size_t written = mSamples.push(samples, count);
+    if ((int)written < count) mDropped.fetch_add(count - written, std::memory_order_relaxed);
+  }
+
+  // Graphics thread: the newest complete spectrum
+  const std::vector<float> &spectrum() { return mSpectra->read(); }
+
+  // Bumped every time a spectrum is published, so readers can skip redraws
+  // when nothing new has arrived
+  unsigned published() const { return mPublished.load(std::memory_order_acquire); }
+
+  int size() const { return mFFT ? mFFT->size() : 0; }
+  int numBins() const { return mFFT ? mFFT->numBins() : 0; }
+  size_t droppedSamples() const { return mDropped.load(std::memory_order_relaxed); }
+
+  // What mapMagnitudes gives at the peak of a sine of this amplitude, right
+  // on a bin (mNorm makes its magnitude amplitude / 2), to calibrate displays
+  static float sineLevel(float amplitude) { return (float)tanh(pow(0.5 * amplitude, 1.3)); }
+
+  // Maps bin magnitudes to tanh(|X|^1.3), the curve the spectrogram was
+  // designed around. |X|^1.3 is taken as (re^2 + im^2)^0.65 so there is no
+  // sqrt, and everything is the branch-free helpers from FastMath.hpp.
+  static void mapMagnitudes(const float *re, const float *im, float *out, int n,
+                            float norm)
+  {
+    const float norm2 = norm * norm;
+    for (int k = 0; k < n; ++k) {
+      float power = (re[k] * re[k] + im[k] * im[k]) * norm2 + 1e-30f;
+      out[k] = fastTanh(fastPow(power, 0.65f));
+    }
+  }
+
+private:
+  void run()
+  {
+    const int n = mFFT->size();
+    float chunk[512];
+    while (mRunning) {
+      size_t got = mSamples.pop(chunk, 512);
+      if (got == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        continue;
+      }
+      for (size_t i = 0; i < got;) {
+        size_t take = std::min(got - i, (size_t)(n - mFill));
+        memcpy(&mInput[mFill], &chunk[i], take * sizeof(float));
+        mFill += (int)take;
+        i += take;
+        if (mFill == n) {
+          analyze();
+          memmove(&mInput[0], &mInput[mHop], (n - mHop) * sizeof(float));
+          mFill = n - mHop;
+        }
+      }
+    }
+  }
+
+  void analyze()
+  {
+    const int n = mFFT->size();
+    for (int i = 0; i < n; ++i) mWindowed[i] = mInput[i] * mWindow[i];
+    mFFT->forward(mWindowed.data(), mRe.data(), mIm.data());
+    std::vector<float> &out = mSpectra->back();
+    mapMagnitudes(mRe.data(), mIm.data(), out.data(), mFFT->numBins(), mNorm);
+    mSpectra->publish();
+    mPublished.fetch_add(1, std::memory_order_release);
+  }
+
+  SpscRing<float> mSamples;
+  std::unique_ptr<RealFFT> mFFT;
+  std::unique_ptr<TripleBuffer<std::vector<float>>> mSpectra;
+  std::vector<float> mWindow, mInput, mWindowed, mRe, mIm;
+  float mNorm = 1;
+  int mHop = 0;
+  int mFill = 0;
+  std::atomic<bool> mRunning{false};
+  std::atomic<size_t> mDropped{0};
+  std::atomic<unsigned> mPublished{0};
+  std::thread mThread;
+};
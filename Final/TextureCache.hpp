@@ -0,0 +1,264 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "AssetArchive.hpp"
+#include "BinaryMesh.hpp" // MappedFile, fileStamp
+#include "al/graphics/al_Image.hpp"
+#include "al/graphics/al_Texture.hpp"
+
+// An RGBA8 image and its whole mip chain down to 1x1, each level a 2x2 box
+// filter of the one above.
+//
+// A chain built from an image file is cached next to it as a .mips file:
+//   MipChainHeader
+//   level 0 pixels, level 1 pixels, ... back to back
+// Later loads map that file (or the copy packed in the asset archive) instead
+// of decoding the image again. Like the baked meshes, the cache remembers the
+// size and modification time of the image and is rebuilt when those change.
+
+static const char kMipChainMagic[4] = {'M', 'I', 'P', 'S'};
+static const uint32_t kMipChainVersion = 1;
+
+struct MipChainHeader
+{
+  char magic[4];
+  uint32_t version;
+  uint64_t sourceSize;
+  int64_t sourceMTime;
+  uint32_t width;
+  uint32_t height;
+  uint32_t levels;
+  uint32_t reserved;
+};
+
+class MipChain
+{
+public:
+  int width(int level = 0) const { return std::max(1, mWidth >> level); }
+  int height(int level = 0) const { return std::max(1, mHeight >> level); }
+  int levels() const { return (int)mLevels.size(); }
+  const uint8_t *pixels(int level) const { return mLevels[level]; }
+  bool empty() const { return mLevels.empty(); }
+
+  // Builds the chain from width x height RGBA pixels
+  void build(const uint8_t *rgba, int width, int height)
+  {
+    mWidth = width;
+    mHeight = height;
+    mMapped.reset();
+    size_t total = 0;
+    const int count = levelCount(width, height);
+    for (int l = 0; l < count; ++l) total += bytes(l);
+    mStorage.resize(total);
+    mLevels.clear();
+    size_t at = 0;
+    for (int l = 0; l < count; ++l) {
+      mLevels.push_back(mStorage.data() + at);
+      at += bytes(l);
+    }
+    std::copy(rgba, rgba + bytes(0), mStorage.begin());
+
+    // Odd sizes drop their last row or column, close enough for a sky
+    for (int l = 1; l < count; ++l) {
+      const int w = this->width(l), h = this->height(l), pw = this->width(l - 1), ph = this->height(l - 1);
+      const uint8_t *src = mLevels[l - 1];
+      uint8_t *dst = const_cast<uint8_t *>(mLevels[l]);
+      for (int y = 0; y < h; ++y) {
+        const uint8_t *r0 = src + (size_t)std::min(2 * y, ph - 1) * pw * 4;
+        const uint8_t *r1 = src + (size_t)std::min(2 * y + 1, ph - 1) * pw * 4;
+        for (int x = 0; x < w; ++x) {
+          const int x0 = std::min(2 * x, pw - 1) * 4, x1 = std::min(2 * x + 1, pw - 1) * 4;
+          for (int c = 0; c < 4; ++c)
+            dst[((size_t)y * w + x) * 4 + c] = (uint8_t)((r0[x0 + c] + r0[x1 + c] + r1[x0 + c] + r1[x1 + c] + 2) / 4);
+        }
+      }
+    }
+  }
+
+  // Maps a cache file. False if it's missing, broken or older than sourcePath.
+  bool load(const std::string &path, const std::string &sourcePath)
+  {
+    auto file = std::make_unique<MappedFile>();
+    if (!file->open(path) || !view(file->data(), file->size(), sourcePath)) return false;
+    mMapped = std::move(file);
+    return true;
+  }
+
+  // Uses a .mips image someone else keeps alive, like a packed asset
+  bool view(const uint8_t *data, size_t size, const std::string &sourcePath)
+  {
+    if (size < sizeof(MipChainHeader)) return false;
+    const MipChainHeader &h = *(const MipChainHeader *)data;
+    if (memcmp(h.magic, kMipChainMagic, 4) != 0 || h.version != kMipChainVersion || h.width == 0 ||
+        h.height == 0 || (int)h.levels != levelCount(h.width, h.height))
+      return false;
+    uint64_t sourceSize;
+    int64_t mtime;
+    if (fileStamp(sourcePath, sourceSize, mtime) && (sourceSize != h.sourceSize || mtime != h.sourceMTime))
+      return false;
+
+    mWidth = (int)h.width;
+    mHeight = (int)h.height;
+    size_t at = sizeof(MipChainHeader);
+    for (int l = 0; l < (int)h.levels; ++l) at += bytes(l);
+    if (at > size) return false;
+
+    mLevels.clear();
+    at = sizeof(MipChainHeader);
+    for (int l = 0; l < (int)h.levels; ++l) {
+      mLevels.push_back(data + at);
+      at += bytes(l);
+    }
+    mStorage.clear();
+    mMapped.reset();
+    return true;
+  }
+
+  // The .mips image of the chain
+  std::vector<uint8_t> serialize(const std::string &sourcePath) const
+  {
+    MipChainHeader h = {};
+    memcpy(h.magic, kMipChainMagic, 4);
+    h.version = kMipChainVersion;
+    fileStamp(sourcePath, h.sourceSize, h.sourceMTime);
+    h.width = (uint32_t)mWidth;
+    h.height = (uint32_t)mHeight;
+    h.levels = (uint32_t)levels();
+    std::vector<uint8_t> out(sizeof(h));
+    memcpy(out.data(), &h, sizeof(h));
+    for (int l = 0; l < levels(); ++l) out.insert(out.end(), mLevels[l], mLevels[l] + bytes(l));
+    return out;
+  }
+
+  bool save(const std::string &path, const std::string &sourcePath) const
+  {
+    const std::vector<uint8_t> image = serialize(sourcePath);
+    FILE *f = fopen(path.c_str(), "wb");
+    if (!f) return false;
+    bool ok = fwrite(image.data(), 1, image.size(), f) == image.size();
+    ok = fclose(f) == 0 && ok;
+    if (!ok) remove(path.c_str()); // never leave half a cache behind
+    return ok;
+  }
+
+private:
+  static int levelCount(int width, int height)
+  {
+    int n = 1;
+    while ((width >> n) > 0 || (height >> n) > 0) ++n;
+    return n;
+  }
+
+  size_t bytes(int level) const { return (size_t)width(level) * height(level) * 4; }
+
+  int mWidth = 0, mHeight = 0;
+  std::vector<const uint8_t *> mLevels;
+  std::vector<uint8_t> mStorage;       // when built
+  std::unique_ptr<MappedFile> mMapped; // when loaded from the cache
+};
+
+// Loads an image into a mipmapped texture without holding up the first
+// frame.
+//
+// start() reads the cached mip chain, or decodes the image and writes the
+// cache, on a background thread. The graphics thread calls update() every
+// frame; the texture keeps whatever it had (a placeholder) until the chain
+// is ready, then gets every level uploaded at once.
+class AsyncTexture
+{
+public:
+  ~AsyncTexture()
+  {
+    if (mThread.joinable()) mThread.join();
+  }
+
+  void start(const std::string &path)
+  {
+    mPath = path;
+    mStart = Clock::now();
+    mThread = std::thread([this] { loadChain(); });
+  }
+
+  // Graphics thread. True on the frame the texture is replaced.
+  bool update(al::Texture &texture)
+  {
+    if (mUploaded || !mReady.load(std::memory_order_acquire)) return false;
+    mThread.join();
+    mUploaded = true;
+    if (mChain.empty()) return false; // load failed, keep the placeholder
+
+    texture.create2D(mChain.width(), mChain.height(), GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);
+    texture.bind();
+    for (int l = 0; l < mChain.levels(); ++l)
+      glTexImage2D(GL_TEXTURE_2D, l, GL_RGBA8, mChain.width(l), mChain.height(l), 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                   mChain.pixels(l));
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, mChain.levels() - 1);
+    texture.unbind();
+    texture.filterMin(al::Texture::LINEAR_MIPMAP_LINEAR);
+    texture.filterMag(al::Texture::LINEAR);
+    mShownMs = msSince(mStart);
+    mChain = MipChain(); // it's on the GPU now
+    return true;
+  }
+
+  const char *source() const { return mSource; }
+  double loadMs() const { return mLoadMs; }   // background thread, start to ready
+  double shownMs() const { return mShownMs; } // start to upload
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  static double msSince(Clock::time_point t)
+  {
+    return std::chrono::duration<double, std::milli>(Clock::now() - t).count();
+  }
+
+  static std::string cachePath(const std::string &path)
+  {
+    size_t dot = path.find_last_of('.');
+    size_t slash = path.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) return path + ".mips";
+    return path.substr(0, dot) + ".mips";
+  }
+
+  void loadChain()
+  {
+    const std::string cache = cachePath(mPath);
+    AssetArchive::View packed = AssetArchive::instance().find(mPath, AssetType::Texture);
+    if (packed && mChain.view(packed.data, packed.size, mPath)) {
+      mSource = "asset archive";
+    } else if (mChain.load(cache, mPath)) {
+      mSource = "mip cache";
+    } else {
+      mSource = "decoded (cold, cache written)";
+      al::Image image;
+      if (image.load(mPath) && image.width() > 0 && image.height() > 0) {
+        mChain.build(image.array().data(), (int)image.width(), (int)image.height());
+        if (!mChain.save(cache, mPath)) printf("AsyncTexture: could not write %s\n", cache.c_str());
+      } else {
+        fprintf(stderr, "Could not load image: %s\n", mPath.c_str());
+      }
+    }
+    mLoadMs = msSince(mStart);
+    mReady.store(true, std::memory_order_release);
+  }
+
+  std::string mPath;
+  std::thread mThread;
+  MipChain mChain; // written by the thread until mReady
+  std::atomic<bool> mReady{false};
+  const char *mSource = "";
+  bool mUploaded = false;
+  Clock::time_point mStart;
+  double mLoadMs = 0, mShownMs = 0;
+};
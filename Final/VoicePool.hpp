@@ -0,0 +1,137 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "al/scene/al_PolySynth.hpp"
+
+// How VoicePool picks the note to cut when every voice is busy
+enum class StealPolicy { Oldest, Quietest, LowestPriority };
+
+// Seconds a stolen voice takes to fade out
+constexpr float stealFadeTime = 0.01f;
+
+// A fixed number of voices for one PolySynth, all allocated up front, with
+// voice stealing once they are busy.
+//
+// Up to `polyphony` notes sound at once. Starting one more steals a
+// sounding note, which fades out over stealFadeTime, and the new note takes
+// one of `reserve` extra voices kept for notes that are still fading. The
+// synth never holds more than polyphony + reserve voices, and the audio
+// thread never allocates one (a voice's init() builds parameters and meshes).
+//
+// One lock is left on the audio thread: start() takes its voice from
+// PolySynth::getVoice, which locks the synth's free list mutex. The other
+// users of that mutex are the synth's render(), on this same thread, which
+// returns finished voices to the free list, and allocate() before audio
+// starts, so it is never contended here. VoicePool can't keep a free list of
+// its own instead, since voices are linked through SynthVoice::next and can
+// only be on one of the synth's lists at a time.
+//
+// V needs
+//   int64_t startFrame; int priority; bool stolen;
+//   float level() const;    // how loud it is now, for Quietest
+//   void steal(int offset); // fade out from `offset` in the coming block
+template <class V>
+class VoicePool
+{
+public:
+  explicit VoicePool(al::PolySynth &synth) : mSynth(synth) {}
+
+  // Before audio starts. Calling it again only adds the missing voices.
+  void allocate(int polyphony, int reserve)
+  {
+    mPolyphony = polyphony;
+    if (polyphony + reserve > mSize) mSynth.allocatePolyphony<V>(polyphony + reserve - mSize);
+    mSize = std::max(mSize, polyphony + reserve);
+    mStarted.resize(mSize);
+  }
+
+  // Audio thread, before the block's commands. Voices started since the
+  // last render aren't in the active list yet, so they're kept here.
+  void beginBlock() { mStartedCount = 0; }
+
+  // Audio thread. Calls f(V *) for every voice the synth is rendering plus
+  // the ones started this block, which it hasn't triggered yet.
+  template <class F>
+  void forEach(F f)
+  {
+    for (al::SynthVoice *v = mSynth.getActiveVoices(); v; v = v->next) f(static_cast<V *>(v));
+    for (int i = 0; i < mStartedCount; ++i) f(mStarted[i]);
+  }
+
+  // Audio thread. A voice for a note starting at audio frame `frame`,
+  // `offset` frames into the coming block, stealing one if the polyphony is
+  // used up. nullptr (counted in dropped()) when even the reserve is busy.
+  V *start(int64_t frame, int offset, int priority)
+  {
+    int busy = mStartedCount, sounding = mStartedCount, finishing = 0;
+    V *victim = nullptr;
+    const StealPolicy policy = this->policy();
+    for (al::SynthVoice *v = mSynth.getActiveVoices(); v; v = v->next) {
+      V *voice = static_cast<V *>(v);
+      // Already called free(), so neither playing nor worth stealing
+      if (!voice->active()) {
+        ++finishing;
+        continue;
+      }
+      ++busy;
+      if (voice->stolen) continue;
+      ++sounding;
+      if (!victim || before(policy, voice, victim)) victim = voice;
+    }
+    // Finished voices only go back on the free list at the end of the synth's
+    // render(), which normally comes before the next start(). Until then
+    // getVoice can't return them and would allocate a new voice instead.
+    if (busy + finishing >= mSize) {
+      mDropped.store(mDropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    if (sounding >= mPolyphony && victim) {
+      victim->steal(offset);
+      mStolen.store(mStolen.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    V *voice = mSynth.getVoice<V>(); // from the free list, there's one left
+    if (!voice) return nullptr;
+    mStarted[mStartedCount++] = voice;
+    voice->startFrame = frame;
+    voice->priority = priority;
+    voice->stolen = false;
+    return voice;
+  }
+
+  // Any thread
+  void policy(StealPolicy p) { mPolicy.store((int)p, std::memory_order_relaxed); }
+  StealPolicy policy() const { return (StealPolicy)mPolicy.load(std::memory_order_relaxed); }
+  int size() const { return mSize; }
+  uint64_t stolen() const { return mStolen.load(std::memory_order_relaxed); }
+  uint64_t dropped() const { return mDropped.load(std::memory_order_relaxed); }
+
+private:
+  // Whether a should be stolen before b. Ties go to the older note.
+  static bool before(StealPolicy policy, const V *a, const V *b)
+  {
+    switch (policy) {
+    case StealPolicy::Quietest:
+      if (a->level() != b->level()) return a->level() < b->level();
+      break;
+    case StealPolicy::LowestPriority:
+      if (a->priority != b->priority) return a->priority < b->priority;
+      break;
+    default: break;
+    }
+    return a->startFrame < b->startFrame;
+  }
+
+  al::PolySynth &mSynth;
+  int mPolyphony = 0;
+  int mSize = 0;
+  std::vector<V *> mStarted; // audio thread, room for every voice
+  int mStartedCount = 0;
+  std::atomic<int> mPolicy{(int)StealPolicy::Oldest};
+  std::atomic<uint64_t> mStolen{0};
+  std::atomic<uint64_t> mDropped{0};
+};
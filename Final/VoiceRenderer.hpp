@@ -0,0 +1,273 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "BlockDSP.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// Renders synth voices on worker threads.
+//
+// During PolySynth::render each voice queues itself with add() instead of
+// rendering. Then run() has the workers and the audio thread claim voices
+// one at a time; workers add into their own scratch buffers and the audio
+// thread into the output, and the scratch buffers are summed into the
+// output at the end. The audio thread never waits for a worker to wake up,
+// only for voices a worker has already started, and nothing allocates after
+// start().
+//
+// stop() can come from another thread while audio is still running: add()
+// stops taking voices and stop() waits out the block in progress before it
+// touches the workers.
+//
+// The audio thread makes no syscalls here: it never wakes anyone. It stamps
+// each block's start time, and the workers use the spacing of those stamps
+// to sleep until shortly before the next block is due, spin through the
+// expected start, and fall back to polling every millisecond when blocks
+// stop coming. A worker that oversleeps just misses that block's voices.
+//
+// Off by default (0 workers); see --render-scaling in main.cpp for whether
+// it pays on a given machine.
+class VoiceRenderer
+{
+public:
+  static const int maxJobs = 1024;
+
+  static VoiceRenderer &instance()
+  {
+    static VoiceRenderer renderer;
+    return renderer;
+  }
+
+  ~VoiceRenderer() { stop(); }
+
+  // Not on the audio thread. 0 workers renders every voice inline.
+  void start(int workers, int maxFrames)
+  {
+    stop();
+    mMaxFrames = maxFrames;
+    mRunning = true;
+    mWorkers.clear();
+    for (int w = 0; w < workers; ++w) mWorkers.emplace_back(new Worker(maxFrames));
+    for (int w = 0; w < workers; ++w) mWorkers[w]->thread = std::thread([this, w] { workerLoop(w); });
+    mAccepting.store(true);
+  }
+
+  // Any thread but the audio thread
+  void stop()
+  {
+    // Either the audio thread sees this before its next block and renders
+    // inline, or this sees its block and waits for run() to finish it
+    mAccepting.store(false);
+    while (mInBlock.load()) std::this_thread::yield();
+    if (!mRunning) return;
+    mRunning = false;
+    for (auto &w : mWorkers) w->thread.join();
+    mWorkers.clear();
+  }
+
+  int workers() const { return (int)mWorkers.size(); }
+
+  // Fewer voices than this are rendered inline, handing them out would cost
+  // more than it saves
+  void minParallel(int jobs) { mMinParallel = jobs; }
+
+  // Audio thread: queues voice->renderJob(left, right, frames) for run(),
+  // at `start` frames into the block. False if there are no workers, the
+  // queue is full or the renderer is stopping, then the voice should render
+  // itself.
+  template <class V>
+  bool add(V *voice, int start, int frames)
+  {
+    if (mCount == 0 && !enterBlock()) return false;
+    if (mWorkers.empty() || mCount == maxJobs || start + frames > mMaxFrames) return false;
+    mJobs[mCount++] = {[](void *v, float *l, float *r, int n) { static_cast<V *>(v)->renderJob(l, r, n); },
+                       voice, start, frames};
+    return true;
+  }
+
+  // Audio thread: renders everything queued since the last run() and adds
+  // it into left/right
+  void run(float *left, float *right, int frames)
+  {
+    runJobs(left, right, frames);
+    mInBlock.store(false, std::memory_order_release);
+  }
+
+private:
+  struct Job
+  {
+    void (*render)(void *voice, float *left, float *right, int frames);
+    void *voice;
+    int start;
+    int frames;
+  };
+
+  struct Worker
+  {
+    explicit Worker(int frames) : left(new float[frames]), right(new float[frames]) {}
+    std::thread thread;
+    std::unique_ptr<float[]> left, right;
+    std::atomic<uint32_t> gen{0}; // last block it rendered into its scratch
+  };
+
+  // Audio thread, before the first add() of a block. Both sides store then
+  // load (sequentially consistent), so stop() can't miss a block.
+  bool enterBlock()
+  {
+    mInBlock.store(true);
+    if (mAccepting.load()) return true;
+    mInBlock.store(false);
+    return false;
+  }
+
+  void runJobs(float *left, float *right, int frames)
+  {
+    const int count = mCount;
+    mCount = 0;
+    if (count == 0) return;
+    if (count < mMinParallel) {
+      for (int i = 0; i < count; ++i) render(mJobs[i], left, right);
+      return;
+    }
+
+    const uint32_t gen = ++mGeneration;
+    mFrames = frames;
+    mDone.store(0, std::memory_order_relaxed);
+    mClaim.store(((uint64_t)gen << 32) | ((uint64_t)count << 16), std::memory_order_release);
+    mBlockStart.store(now(), std::memory_order_relaxed);
+    mWake.store(gen, std::memory_order_release);
+
+    int64_t job;
+    while ((job = claim(gen)) >= 0) {
+      render(mJobs[job], left, right);
+      mDone.fetch_add(1, std::memory_order_release);
+    }
+    while (mDone.load(std::memory_order_acquire) < count) pause();
+
+    for (auto &w : mWorkers) {
+      if (w->gen.load(std::memory_order_relaxed) != gen) continue; // didn't get a voice
+      const float *BLOCK_RESTRICT l = w->left.get();
+      const float *BLOCK_RESTRICT r = w->right.get();
+      for (int i = 0; i < frames; ++i) {
+        left[i] += l[i];
+        right[i] += r[i];
+      }
+    }
+  }
+
+  static void render(const Job &job, float *left, float *right)
+  {
+    job.render(job.voice, left + job.start, right + job.start, job.frames);
+  }
+
+  // Next job of block `gen`, -1 once they're all taken or the block is over.
+  // mClaim holds the block's generation, job count and next job.
+  int64_t claim(uint32_t gen)
+  {
+    uint64_t c = mClaim.load(std::memory_order_acquire);
+    for (;;) {
+      const uint32_t next = c & 0xffff, count = (c >> 16) & 0xffff;
+      if ((uint32_t)(c >> 32) != gen || next >= count) return -1;
+      if (mClaim.compare_exchange_weak(c, c + 1, std::memory_order_acq_rel, std::memory_order_acquire))
+        return next;
+    }
+  }
+
+  void workerLoop(int w)
+  {
+    Worker &me = *mWorkers[w];
+    uint32_t seen = mWake.load();
+    int64_t lastStart = 0, period = 0;
+    while (mRunning) {
+      const uint32_t gen = waitForBlock(seen, lastStart + period);
+      seen = gen;
+      // Blocks come at a steady rate while audio runs; anything longer than
+      // kMaxPeriod is a pause, not a period
+      const int64_t start = mBlockStart.load(std::memory_order_relaxed);
+      period = start - lastStart < kMaxPeriod ? start - lastStart : 0;
+      lastStart = start;
+      bool joined = false;
+      int64_t job;
+      while ((job = claim(gen)) >= 0) {
+        if (!joined) {
+          // First voice this block: start from silence, and tell run() to
+          // sum this worker in
+          std::fill(me.left.get(), me.left.get() + mFrames, 0.0f);
+          std::fill(me.right.get(), me.right.get() + mFrames, 0.0f);
+          me.gen.store(gen, std::memory_order_relaxed);
+          joined = true;
+        }
+        render(mJobs[job], me.left.get(), me.right.get());
+        mDone.fetch_add(1, std::memory_order_release);
+      }
+    }
+  }
+
+  // Until run() publishes a block after `seen`: sleeps until kSpinMicros
+  // before `due` (0 if unknown), spins until kSpinMicros after it, then polls
+  uint32_t waitForBlock(uint32_t seen, int64_t due)
+  {
+    const int64_t margin = kSpinMicros * 1000;
+    for (int i = 0;; ++i) {
+      uint32_t gen = mWake.load(std::memory_order_acquire);
+      if (gen != seen || !mRunning) return gen;
+      if ((i & 63) != 63) {
+        pause();
+        continue;
+      }
+      const int64_t t = now();
+      if (due > 0 && t < due - margin)
+        std::this_thread::sleep_for(std::chrono::nanoseconds(std::min(due - margin - t, kPollNanos)));
+      else if (due == 0 || t > due + margin)
+        std::this_thread::sleep_for(std::chrono::nanoseconds(kPollNanos));
+    }
+  }
+
+  // steady_clock in nanoseconds; a vDSO read on Linux, not a syscall
+  static int64_t now()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  static void pause()
+  {
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__)
+    _mm_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+  }
+
+  static const int kSpinMicros = 200;
+  static const int64_t kPollNanos = 1000000;
+  static const int64_t kMaxPeriod = 100000000;
+
+  std::vector<std::unique_ptr<Worker>> mWorkers;
+  std::atomic<bool> mRunning{false};
+  std::atomic<bool> mAccepting{false}; // add() takes voices, see stop()
+  std::atomic<bool> mInBlock{false};   // audio thread is between add() and run()
+  int mMaxFrames = 0;
+  int mMinParallel = 4;
+
+  // Audio thread
+  Job mJobs[maxJobs];
+  int mCount = 0;
+  uint32_t mGeneration = 0;
+
+  // Shared with the workers. mJobs and mFrames are published by mClaim.
+  int mFrames = 0;
+  std::atomic<uint64_t> mClaim{0};
+  std::atomic<int> mDone{0};
+  std::atomic<uint32_t> mWake{0};       // generation of the last block
+  std::atomic<int64_t> mBlockStart{0}; // now() when it was published
+};
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Streams 32-bit float WAV files, a block at a time. The header's sizes are
+// filled in by close().
+//
+// The format is WAVE_FORMAT_IEEE_FLOAT with the 18 byte fmt chunk and the
+// fact chunk that non-PCM WAV files need. RIFF sizes are 32 bits, so a file
+// holds at most maxFrames(); write() stops there and returns false.
+class WavWriter
+{
+public:
+  ~WavWriter() { close(); }
+
+  // Most frames a file with this many channels can hold
+  static uint64_t maxFrames(int channels)
+  {
+    return (UINT32_MAX - kHeaderBytes + 8) / (channels * sizeof(float));
+  }
+
+  bool open(const std::string &path, int channels, int sampleRate)
+  {
+    close();
+    mFile = fopen(path.c_str(), "wb");
+    if (!mFile) return false;
+    mChannels = channels;
+    mSampleRate = sampleRate;
+    mFrames = 0;
+    writeHeader(); // placeholder sizes until close()
+    return true;
+  }
+
+  // Interleaves frames samples from each of the channels. False on a write
+  // error, or if the file is full and only part (or none) of it was written.
+  bool write(const float *const *channels, int frames)
+  {
+    if (!mFile) return false;
+    const uint64_t room = maxFrames(mChannels) - mFrames;
+    const int take = room < (uint64_t)frames ? (int)room : frames;
+    mInterleaved.resize((size_t)take * mChannels);
+    for (int c = 0; c < mChannels; ++c)
+      for (int i = 0; i < take; ++i) mInterleaved[(size_t)i * mChannels + c] = channels[c][i];
+    size_t n = fwrite(mInterleaved.data(), sizeof(float), mInterleaved.size(), mFile);
+    mFrames += n / mChannels;
+    return n == mInterleaved.size() && take == frames;
+  }
+
+  void close()
+  {
+    if (!mFile) return;
+    fseek(mFile, 0, SEEK_SET);
+    writeHeader();
+    fclose(mFile);
+    mFile = nullptr;
+  }
+
+  uint64_t frames() const { return mFrames; }
+
+private:
+  void put32(uint32_t v) { fwrite(&v, 4, 1, mFile); } // WAV is little endian, like every target we build for
+  void put16(uint16_t v) { fwrite(&v, 2, 1, mFile); }
+
+  // Everything before the samples: RIFF, WAVE, fmt (18), fact (4), data
+  static const uint32_t kHeaderBytes = 12 + 8 + 18 + 8 + 4 + 8;
+
+  void writeHeader()
+  {
+    // write() keeps mFrames within maxFrames(), so none of this wraps
+    const uint32_t dataBytes = (uint32_t)(mFrames * mChannels * sizeof(float));
+    fwrite("RIFF", 1, 4, mFile);
+    put32(kHeaderBytes - 8 + dataBytes);
+    fwrite("WAVE", 1, 4, mFile);
+    fwrite("fmt ", 1, 4, mFile);
+    put32(18);
+    put16(3); // WAVE_FORMAT_IEEE_FLOAT
+    put16((uint16_t)mChannels);
+    put32((uint32_t)mSampleRate);
+    put32((uint32_t)(mSampleRate * mChannels * sizeof(float)));
+    put16((uint16_t)(mChannels * sizeof(float)));
+    put16(32);
+    put16(0); // no extension
+    fwrite("fact", 1, 4, mFile);
+    put32(4);
+    put32((uint32_t)mFrames); // frames per channel
+    fwrite("data", 1, 4, mFile);
+    put32(dataBytes);
+  }
+
+  FILE *mFile = nullptr;
+  int mChannels = 0;
+  int mSampleRate = 0;
+  uint64_t mFrames = 0;
+  std::vector<float> mInterleaved;
+};
@@ -0,0 +1,492 @@
+// Microbenchmarks for the parts of the app that don't draw or touch the
+// audio device. Plain C++, allolib is only needed for `decision`:
+//
+//   c++ -std=c++17 -O3 bench.cpp -o bench
+//   ./bench [markov fft clip voice decision ...]
+//
+// decision uses allolib's al::rnd, so it is only built with
+//
+//   c++ -std=c++17 -O3 -DBENCH_ALLOLIB -I<allolib>/include bench.cpp -L<allolib>/lib -lal -o bench
+//
+// With Gamma built, -DBENCH_GAMMA adds gam::STFT, the analysis the
+// spectrogram used to run, to the fft benchmark:
+//
+//   c++ -std=c++17 -O3 -DBENCH_GAMMA -I<Gamma> bench.cpp -L<Gamma>/lib -lGamma -o bench
+//
+// With no arguments every benchmark runs. Times are per call, averaged over
+// enough calls to take a good fraction of a second, so they are only as
+// steady as the machine is quiet. Use -O3 like the app's release build; at
+// -O2 GCC 12 doesn't vectorize the FastMath loops.
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <vector>
+
+#include "HarmonyTables.hpp"
+#include "MarkovModel.hpp"
+#include "BlockDSP.hpp"
+#include "FastMath.hpp"
+#include "RealFFT.hpp"
+#include "SoftClip.hpp"
+#include "SpectrumAnalyzer.hpp"
+
+#if BENCH_GAMMA
+#include "Gamma/DFT.h"
+#endif
+#if BENCH_ALLOLIB
+#include "NoteDecision.hpp"
+#endif
+
+using namespace std;
+
+// Every allocation in the program goes through here, so a benchmark can
+// check that what it times allocates nothing
+static size_t allocations = 0;
+
+void *operator new(size_t size)
+{
+  ++allocations;
+  if (void *p = malloc(size ? size : 1)) return p;
+  throw bad_alloc();
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+namespace {
+
+double now()
+{
+  return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// xorshift, so the generator costs next to nothing next to what is timed
+struct Random
+{
+  uint32_t state = 2463534242u;
+  uint32_t next()
+  {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+  }
+  float uniform() { return (next() >> 8) * (1.0f / 16777216.0f); }
+};
+
+// Keeps results alive so the optimizer can't drop the work
+volatile int sinkInt;
+volatile float sinkFloat;
+
+// ---- Markov sampling ------------------------------------------------------
+
+// The lookup MarkovModel replaced: a dense first-order table scanned by
+// cumulative probability
+int scanRow(const float *row, int states, float u)
+{
+  float sum = 0;
+  for (int i = 0; i < states; ++i) {
+    sum += row[i];
+    if (u < sum) return i;
+  }
+  return states - 1;
+}
+
+void benchMarkov()
+{
+  const int samples = 4000000;
+  Random rng;
+
+  // The app's chord model, built the way NoteDecision builds it
+  {
+    const int n = harmony::numChords;
+    MarkovModel model(n, 1);
+    for (int from = 0; from < n; ++from)
+      for (int to = 0; to < n; ++to)
+        if (harmony::chordMarkov[from][to] > 0) model.add(&from, 1, to, harmony::chordMarkov[from][to]);
+    model.build();
+
+    int state = 0;
+    double start = now();
+    for (int i = 0; i < samples; ++i) state = model.sample(&state, 1, rng.uniform());
+    double alias = (now() - start) / samples;
+    sinkInt = state;
+
+    state = 0;
+    start = now();
+    for (int i = 0; i < samples; ++i) state = scanRow(harmony::chordMarkov[state], n, rng.uniform());
+    double scan = (now() - start) / samples;
+    sinkInt = state;
+    printf("markov: chord model (8 states, order 1)   alias %.1f ns   scan %.1f ns\n",
+           alias * 1e9, scan * 1e9);
+  }
+
+  // Larger vocabularies with full random rows, where the scan grows with the
+  // row and the alias table doesn't
+  for (int n : {4, 8, 16, 32, 64}) {
+    vector<float> table(n * n);
+    for (int from = 0; from < n; ++from) {
+      float total = 0;
+      for (int to = 0; to < n; ++to) total += table[from * n + to] = 0.05f + rng.uniform();
+      for (int to = 0; to < n; ++to) table[from * n + to] /= total;
+    }
+    MarkovModel model(n, 1);
+    for (int from = 0; from < n; ++from)
+      for (int to = 0; to < n; ++to) model.add(&from, 1, to, table[from * n + to]);
+    model.build();
+
+    int state = 0;
+    double start = now();
+    for (int i = 0; i < samples; ++i) state = model.sample(&state, 1, rng.uniform());
+    double alias = (now() - start) / samples;
+    sinkInt = state;
+
+    state = 0;
+    start = now();
+    for (int i = 0; i < samples; ++i) state = scanRow(&table[state * n], n, rng.uniform());
+    double scan = (now() - start) / samples;
+    sinkInt = state;
+    printf("markov: %2d full rows                      alias %.1f ns   scan %.1f ns\n", n,
+           alias * 1e9, scan * 1e9);
+  }
+
+  // Training a higher order model from a corpus of progressions, then
+  // sampling with backoff. The corpus is a random walk that mostly steps to
+  // nearby chords, so only part of the possible contexts are ever seen.
+  for (int order : {1, 2, 3}) {
+    const int states = 48, length = 200000;
+    vector<int> corpus(length);
+    int chord = 0;
+    for (int &c : corpus) c = chord = (chord + states + (int)(rng.next() % 7) - 3) % states;
+
+    MarkovModel model(states, order);
+    double start = now();
+    model.train(corpus.data(), length);
+    double train = now() - start;
+    start = now();
+    model.build();
+    double build = now() - start;
+
+    int history[8] = {};
+    start = now();
+    for (int i = 0; i < samples; ++i) {
+      int next = model.sample(history, order, rng.uniform());
+      memmove(history, history + 1, (order - 1) * sizeof(int));
+      history[order - 1] = next;
+    }
+    double sample = (now() - start) / samples;
+    sinkInt = history[0];
+    printf("markov: 48 states, order %d, %4zu contexts   train %.1f ns/step   build %.2f ms   "
+           "sample %.1f ns\n",
+           order, model.numContexts(), train / length * 1e9, build * 1e3, sample * 1e9);
+  }
+}
+
+// ---- Spectrum analysis ----------------------------------------------------
+
+// One hop of SpectrumAnalyzer::analyze, without the thread and the buffers
+// around it: window, transform, map the bins
+struct Analysis
+{
+  explicit Analysis(int n) : fft(n), window(n), windowed(n), re(fft.numBins()), im(fft.numBins()), out(fft.numBins())
+  {
+    float sum = 0;
+    for (int i = 0; i < n; ++i) sum += window[i] = 0.5f - 0.5f * (float)cos(2 * M_PI * i / n);
+    norm = 1.0f / sum;
+  }
+
+  void run(const float *in)
+  {
+    for (size_t i = 0; i < window.size(); ++i) windowed[i] = in[i] * window[i];
+    fft.forward(windowed.data(), re.data(), im.data());
+    SpectrumAnalyzer::mapMagnitudes(re.data(), im.data(), out.data(), fft.numBins(), norm);
+  }
+
+  RealFFT fft;
+  vector<float> window, windowed, re, im, out;
+  float norm;
+};
+
+void benchFFT()
+{
+  const double sampleRate = 48000;
+  Random rng;
+
+  // Accuracy against a direct DFT
+  {
+    const int n = 1024;
+    RealFFT fft(n);
+    vector<float> in(n), re(fft.numBins()), im(fft.numBins());
+    for (float &x : in) x = rng.uniform() - 0.5f;
+    fft.forward(in.data(), re.data(), im.data());
+    double worst = 0;
+    for (int k = 0; k < fft.numBins(); ++k) {
+      double r = 0, i = 0;
+      for (int t = 0; t < n; ++t) {
+        r += in[t] * cos(-2 * M_PI * k * t / n);
+        i += in[t] * sin(-2 * M_PI * k * t / n);
+      }
+      worst = max(worst, fabs(r - re[k]) + fabs(i - im[k]));
+    }
+    printf("fft: RealFFT %d vs direct DFT, max error %.2g\n", n, worst);
+  }
+
+  // Time per hop (size / 4 new samples) for every size the analyzer offers
+  for (int n = SpectrumAnalyzer::minSize; n <= SpectrumAnalyzer::maxSize; n *= 2) {
+    Analysis a(n);
+    vector<float> in(n);
+    for (float &x : in) x = rng.uniform() - 0.5f;
+    const int hops = 40000000 / n;
+    double start = now();
+    for (int h = 0; h < hops; ++h) {
+      in[h % n] += 1e-6f;
+      a.fft.forward(in.data(), a.re.data(), a.im.data());
+    }
+    double fft = (now() - start) / hops;
+    start = now();
+    for (int h = 0; h < hops; ++h) {
+      in[h % n] += 1e-6f;
+      a.run(in.data());
+    }
+    double hop = (now() - start) / hops;
+    sinkFloat = a.out[1];
+    printf("fft: %5d   RealFFT %7.1f us   window + fft + map %7.1f us per hop, %5.1f ns per sample\n", n,
+           fft * 1e6, hop * 1e6, hop * 1e9 / (n / 4));
+  }
+
+  // The bin mapping against the libm version it replaced
+  {
+    Analysis a(4096);
+    vector<float> in(4096);
+    for (float &x : in) x = rng.uniform() - 0.5f;
+    a.run(in.data());
+    const int n = a.fft.numBins(), reps = 20000;
+    vector<float> ref(n);
+    double start = now();
+    for (int r = 0; r < reps; ++r) {
+      a.re[r % n] += 1e-6f;
+      SpectrumAnalyzer::mapMagnitudes(a.re.data(), a.im.data(), a.out.data(), n, a.norm);
+    }
+    double fast = (now() - start) / reps;
+    start = now();
+    for (int r = 0; r < reps; ++r) {
+      a.re[r % n] += 1e-6f;
+      for (int k = 0; k < n; ++k)
+        ref[k] = tanh(pow(sqrt(a.re[k] * a.re[k] + a.im[k] * a.im[k]) * a.norm, 1.3f));
+    }
+    double slow = (now() - start) / reps;
+    double worst = 0;
+    for (int k = 0; k < n; ++k) worst = max(worst, (double)fabs(a.out[k] - ref[k]));
+    printf("fft: mapping %d bins   fast %.1f us   tanh/pow %.1f us   max difference %.2g\n", n, fast * 1e6,
+           slow * 1e6, worst);
+  }
+
+  // Where a sine lands, which is what the spectrogram is calibrated on
+  {
+    const int n = 4096;
+    const float amplitude = 0.5f;
+    const double freq = 40 * sampleRate / n; // right on bin 40
+    Analysis a(n);
+    vector<float> in(n);
+    for (int i = 0; i < n; ++i) in[i] = amplitude * (float)sin(2 * M_PI * freq * i / sampleRate);
+    a.run(in.data());
+    float magnitude = sqrt(a.re[40] * a.re[40] + a.im[40] * a.im[40]) * a.norm;
+    printf("fft: sine of amplitude %.2f   magnitude %.4f   level %.4f (sineLevel %.4f)\n", amplitude, magnitude,
+           a.out[40], SpectrumAnalyzer::sineLevel(amplitude));
+  }
+
+#if BENCH_GAMMA
+  // The old analysis, sample by sample, and its magnitude for the same sine
+  gam::sampleRate(sampleRate);
+  for (int n : {4048, 4096}) {
+    gam::STFT stft(n, n / 4, 0, gam::HANN, gam::MAG_FREQ);
+    const int samples = 4000000;
+    int hops = 0;
+    double start = now();
+    for (int i = 0; i < samples; ++i)
+      if (stft(rng.uniform() - 0.5f)) ++hops;
+    double time = now() - start;
+    sinkInt = hops;
+    printf("fft: gam::STFT %d   %7.1f us per hop, %5.1f ns per sample\n", n, time / hops * 1e6, time / samples * 1e9);
+  }
+  {
+    const int n = 4096;
+    const double freq = 40 * sampleRate / n;
+    gam::STFT stft(n, n / 4, 0, gam::HANN, gam::MAG_FREQ);
+    float magnitude = 0;
+    for (int i = 0; i < 4 * n; ++i)
+      if (stft(0.5f * (float)sin(2 * M_PI * freq * i / sampleRate))) magnitude = stft.bin(40).real();
+    printf("fft: gam::STFT, sine of amplitude 0.50   magnitude %.4f\n", magnitude);
+  }
+#endif
+}
+
+// ---- Soft clipper -------------------------------------------------------
+
+void benchClip()
+{
+  // Worst errors of the FastMath helpers over a fine sweep of their ranges
+  double tanhErr = 0, log2Err = 0, exp2Err = 0, powErr = 0;
+  for (double x = -10; x <= 10; x += 1e-5) tanhErr = max(tanhErr, fabs(fastTanh((float)x) - tanh((double)(float)x)));
+  for (double x = 1e-6; x < 1e6; x *= 1.00001) {
+    float f = (float)x;
+    log2Err = max(log2Err, fabs(fastLog2(f) - log2((double)f)));
+    powErr = max(powErr, fabs(fastPow(f, 0.65f) / pow((double)f, 0.65) - 1));
+  }
+  for (double x = -126; x <= 126; x += 1e-4) exp2Err = max(exp2Err, fabs(fastExp2((float)x) / exp2((double)(float)x) - 1));
+  printf("clip: fastTanh abs error %.2g   fastLog2 abs %.2g   fastExp2 rel %.2g   fastPow(x, 0.65) rel %.2g\n",
+         tanhErr, log2Err, exp2Err, powErr);
+
+  // One master bus block, 2 channels of 512 frames, driven well into the curve
+  const int frames = 512, reps = 100000;
+  vector<float> left(frames), right(frames);
+  for (int i = 0; i < frames; ++i) {
+    left[i] = 2 * (float)sin(i * 0.01);
+    right[i] = 2 * (float)cos(i * 0.013);
+  }
+  float *channels[2] = {left.data(), right.data()};
+  SoftClipper clipper;
+  clipper.setup(2, frames);
+
+  double start = now();
+  for (int r = 0; r < reps; ++r) {
+    left[r % frames] += 1e-7f;
+    clipper.process(channels, 2, frames);
+  }
+  double fast = (now() - start) / reps;
+  start = now();
+  for (int r = 0; r < reps; ++r) {
+    left[r % frames] += 1e-7f;
+    for (float *c : channels)
+      for (int i = 0; i < frames; ++i) c[i] = tanh(c[i]);
+  }
+  double libm = (now() - start) / reps;
+  clipper.oversample(true);
+  start = now();
+  for (int r = 0; r < reps / 10; ++r) {
+    left[r % frames] += 1e-7f;
+    clipper.process(channels, 2, frames);
+  }
+  double over = (now() - start) / (reps / 10);
+  sinkFloat = left[0] + right[0];
+  printf("clip: 2 x %d frames   fastTanh %.2f us   std::tanh %.2f us   2x oversampled %.2f us\n", frames,
+         fast * 1e6, libm * 1e6, over * 1e6);
+
+  // Alias energy: a 5 kHz sine driven 3x into the curve, then everything
+  // that isn't a harmonic against the harmonics
+  const double sampleRate = 48000, freq = 5003;
+  const int n = 16384, blocks = 64;
+  for (bool oversample : {false, true}) {
+    SoftClipper c;
+    c.setup(1, frames);
+    c.oversample(oversample);
+    vector<float> x(frames * blocks);
+    for (size_t i = 0; i < x.size(); ++i) x[i] = 3 * (float)sin(2 * M_PI * freq * i / sampleRate);
+    for (int b = 0; b < blocks; ++b) {
+      float *ch = &x[b * frames];
+      c.process(&ch, 1, frames);
+    }
+    RealFFT fft(n);
+    vector<float> windowed(n), re(fft.numBins()), im(fft.numBins());
+    for (int i = 0; i < n; ++i) windowed[i] = x[x.size() - n + i] * (0.5f - 0.5f * (float)cos(2 * M_PI * i / n));
+    fft.forward(windowed.data(), re.data(), im.data());
+    double harmonics = 0, aliases = 0;
+    for (int k = 1; k < fft.numBins(); ++k) {
+      double f = k * sampleRate / n, h = f / freq;
+      (fabs(h - round(h)) * freq < 30 ? harmonics : aliases) += re[k] * re[k] + im[k] * im[k];
+    }
+    printf("clip: %s alias energy %.1f dB below the harmonics\n", oversample ? "2x oversampled:" : "plain:         ",
+           -10 * log10(aliases / harmonics));
+  }
+}
+
+// ---- Voices ---------------------------------------------------------------
+
+// One audio block of the synth voices' DSP (oscillator, envelope, follower,
+// pan) for sine and saw voices, and the allocations it makes
+template <class Osc>
+void benchVoice(const char *name, int voices)
+{
+  const int frames = 512, blocks = 2000;
+  const double sampleRate = 48000;
+  vector<BlockVoice<Osc>> v(voices);
+  for (int i = 0; i < voices; ++i) {
+    v[i].osc.freq(110 + 37 * i, sampleRate);
+    v[i].env.sustain(0.7f);
+    v[i].env.reset();
+  }
+  vector<float> left(frames), right(frames);
+
+  const size_t before = allocations;
+  double start = now();
+  for (int b = 0; b < blocks; ++b) {
+    fill(left.begin(), left.end(), 0.0f);
+    fill(right.begin(), right.end(), 0.0f);
+    for (auto &voice : v) voice.render(left.data(), right.data(), frames, 0.05f, 0.2f, sampleRate);
+  }
+  double time = (now() - start) / blocks;
+  sinkFloat = left[0];
+  printf("voice: %d %s voices   %.1f us per %d frame block, %.2f us per voice, %zu allocations\n", voices, name,
+         time * 1e6, frames, time * 1e6 / voices, allocations - before);
+}
+
+void benchVoices()
+{
+  for (int voices : {1, 16, 64}) {
+    benchVoice<BlockSine>("sine", voices);
+    benchVoice<BlockSaw>("saw", voices);
+  }
+}
+
+#if BENCH_ALLOLIB
+// One chord change as the score makes it: the next chord with its two
+// harmony notes, then a melody over it
+void benchDecision()
+{
+  NoteDecision decision;
+  int notes[2], melody[NoteDecision::maxMelody];
+  const int decisions = 100000;
+  int total = 0;
+  const size_t before = allocations;
+  double start = now();
+  for (int i = 0; i < decisions; ++i) {
+    decision.getNextHarmonyChord(notes);
+    total += decision.generateLSystemMelody(decision.currentChordIndex, melody, 10) + notes[1];
+  }
+  double time = (now() - start) / decisions;
+  sinkInt = total;
+  printf("decision: %.2f us and %.2f allocations per chord change\n", time * 1e6,
+         (double)(allocations - before) / decisions);
+}
+#endif
+
+struct Bench
+{
+  const char *name;
+  void (*run)();
+};
+
+const Bench benches[] = {
+    {"markov", benchMarkov},
+    {"fft", benchFFT},
+    {"clip", benchClip},
+    {"voice", benchVoices},
+#if BENCH_ALLOLIB
+    {"decision", benchDecision},
+#endif
+};
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+  for (const Bench &b : benches) {
+    bool wanted = argc < 2;
+    for (int i = 1; i < argc; ++i) wanted |= strcmp(argv[i], b.name) == 0;
+    if (wanted) b.run();
+  }
+  return 0;
+}
@@ -1,9 +1,10 @@
 #include <cstdio> // for printing to stdout
 #include <stdio.h>
-#include <map>
 #include <vector>
 #include <string>
-#include <set>
+#include <algorithm>
+#include <chrono>
+#include <thread>
 
 #include "Gamma/Analysis.h"
 #include "Gamma/Effects.h"
@@ -26,461 +27,389 @@
 #include "al/graphics/al_Image.hpp"
 #include "al/io/al_File.hpp"
 
+#include "AssetArchive.hpp"
+#include "AudioTimer.hpp"
+#include "BlockDSP.hpp"
+#include "CommandQueue.hpp"
+#include "DrawList.hpp"
+#include "FrameTimer.hpp"
+#include "HarmonyTables.hpp"
+#include "LSystem.hpp"
+#include "MarkovModel.hpp"
+#include "MeshCache.hpp"
+#include "NoteDecision.hpp"
+#include "SampleBank.hpp"
+#include "SelfTest.hpp"
+#include "SoftClip.hpp"
+#include "Spectrogram.hpp"
+#include "SpectrumAnalyzer.hpp"
+#include "TextureCache.hpp"
+#include "VoicePool.hpp"
+#include "VoiceRenderer.hpp"
+#include "WavWriter.hpp"
 
 using namespace al;
 using namespace std;
-#define FFT_SIZE 4048
-
-//Self reminders: Needs to initialize a chord & melody 
-
-class NoteDecision 
+#define FFT_SIZE 4096 // default analysis size, selectable from the GUI
+
+// Every file Final loads. `--pack` decodes them all into assetArchiveFile,
+// which is used instead of the loose files when it's there.
+static const char *const ambienceFile = "../amb.wav";
+static const vector<string> sampleFiles = {"../a.wav", "../b.wav", "../c.wav"};
+static const char *const cloudFile = "../cloud_poly.obj";
+static const char *const skyboxFile = "../skybox.jpg";
+static const char *const assetArchiveFile = "../assets.pak";
+
+// The skybox is the one asset loaded through File::currentPath(); the app
+// and --pack both go through here so they read the same file
+static string skyboxPath() { return File::currentPath() + skyboxFile; }
+
+// Camera state for the frame being drawn, so voices can tell how big they
+// appear on screen. Set by MyApp::onDraw before the voices render.
+struct ScreenSize
 {
-  public: 
-    
-    int currentChordIndex = 0; // Start on "i"
-
-    
-    //Self reminder add the 7th note
-    //V and V 64 are same chord and needs update since previous code bass note is always root
-    std::map<std::string, std::vector<int>> chordDictionary = {
-      { "i",    {48, 52, 55, 36, 40, 43} },  // C E G (C3 + C2) 1 maj
-      { "ii",   {50, 54, 57, 38, 42, 45} },  // D F# A 2 maj
-      { "iii",  {52, 55, 59, 40, 43, 47} },  // E G B 3 min
-      { "iv",   {54, 57, 60, 42, 45, 48} },  // F# A C 4 min
-      { "v",    {55, 59, 50, 43, 47, 38} },  // G B D 5 maj
-      { "v64",  {50, 55, 59, 38, 43, 47} },  // D G B 5 64 maj
-      { "vi",   {57, 60, 64, 45, 48, 52} },  // A C E 6 min
-      { "vii",  {59, 62, 57, 47, 50, 45} }   // B D A 7 dim
-    };
-
-
-    std::map<std::string, std::vector<int>> melodyDictionary = {
-      { "i",    {60, 62, 64, 65, 67, 69, 71, 72, 74, 76, 77, 79, 81, 83, 84} }, // C major (Ionian)
-      { "ii",   {62, 64, 66, 67, 69, 71, 73, 74, 76, 78, 79, 81, 83, 85, 86} }, // D major
-      { "iii",  {64, 66, 67, 69, 71, 73, 75, 76, 78, 79, 81, 83, 85, 87, 88} }, // E minor
-      { "iv",   {66, 67, 69, 71, 72, 74, 76, 78, 79, 81, 83, 84, 86, 88, 90} }, // F# minor
-      { "v",    {67, 69, 71, 72, 74, 76, 78, 79, 81, 83, 84, 86, 88, 90, 91} }, // G major
-      { "v64",  {62, 64, 66, 67, 69, 71, 73, 74, 76, 78, 79, 81, 83, 85, 86} }, // D major (again)
-      { "vi",   {69, 71, 72, 74, 76, 78, 79, 81, 83, 84, 86, 88, 90, 91, 93} }, // A minor
-      { "vii",  {71, 72, 74, 76, 78, 79, 81, 83, 84, 86, 88, 90, 91, 93, 95} }  // B diminished (used like Locrian)
-    };
+  static inline Vec3f eye{0, 0, 0};
+  static inline float pixelsPerUnit = 500; // at distance 1
 
-    
-    std::vector<std::string> chordNames = {"i", "ii", "iii", "iv", "v", "v64", "vi", "vii"};
-    static const int numChords = 8;
-    float harmMarkov[numChords][numChords] = {
-        {0.0f, 0.32f, 0.19f, 0.05f, 0.1f, 0.04f, 0.26f, 0.04f},
-        {0.25f, 0.0f, 0.0f, 0.0f, 0.45f, 0.2f, 0.0f, 0.1f},
-        {0.0f, 0.4f, 0.0f, 0.0f, 0.0f, 0.0f, 0.6f, 0.0f},
-        {0.15f, 0.1f, 0.0f, 0.0f, 0.35f, 0.25f, 0.0f, 0.15f},
-        {0.7f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.3f, 0.0f},
-        {0.1f, 0.0f, 0.0f, 0.0f, 0.9f, 0.0f, 0.0f, 0.0f},
-        {0.0f, 0.5f, 0.0f, 0.0f, 0.5f, 0.0f, 0.0f, 0.0f},
-        {0.5f, 0.0f, 0.0f, 0.0f, 0.2f, 0.3f, 0.0f, 0.0f}
-    };
-
-    int pickNextChordIndex() {
-      float r = rnd::uniform();
-      float sum = 0.0f;
-      for (int i = 0; i < numChords; ++i) {
-          sum += harmMarkov[currentChordIndex][i];
-          if (r <= sum) {
-              return i;
-          }
-      }
-      return currentChordIndex; // fallback
-    }
-
-    std::vector<int> getNextHarmonyChord() {
-      currentChordIndex = pickNextChordIndex();
-      std::string chordName = chordNames[currentChordIndex];
-      std::vector<int> allNotes = chordDictionary[chordName];
+  // Approximate on-screen diameter in pixels of a sphere at pos
+  static float of(const Vec3f &pos, float radius)
+  {
+    float dist = (pos - eye).mag();
+    if (dist < 0.001f) dist = 0.001f;
+    return 2 * radius * pixelsPerUnit / dist;
+  }
+};
 
-      std::random_shuffle(allNotes.begin(), allNotes.end());
+// Sphere geometry shared by every Harm voice. It's built once at startup and
+// never changes afterwards, voices only choose which level of detail to draw.
+class HarmSphere
+{
+public:
+  static const int numLevels = 3;
 
-      std::vector<int> selectedNotes;
-      std::set<int> seen; 
-      for (int note : allNotes) {
-          if (seen.find(note) == seen.end()) {
-              selectedNotes.push_back(note);
-              seen.insert(note);
-          }
-          if (selectedNotes.size() == 2) break;
-      }
+  static const HarmSphere &get()
+  {
+    static HarmSphere sphere;
+    return sphere;
+  }
 
-      while (selectedNotes.size() < 2) {
-          int filler = rnd::uniform(48, 72);
-          if (seen.find(filler) == seen.end()) {
-              selectedNotes.push_back(filler);
-          }
-      }
+  // Picks the level for a sphere covering `pixels` on screen
+  const Mesh &forSize(float pixels) const
+  {
+    if (pixels > 120) return lod[0];
+    if (pixels > 30) return lod[1];
+    return lod[2];
+  }
 
-      return selectedNotes;
+private:
+  HarmSphere()
+  {
+    const int resolution[numLevels] = {100, 40, 16};
+    for (int i = 0; i < numLevels; ++i) {
+      addSphere(lod[i], 1, resolution[i], resolution[i]);
+      lod[i].decompress();
+      lod[i].generateNormals();
     }
+  }
 
-  std::vector<int> generateLSystemMelody(const std::string &chordName) {
-    // Terminal symbols: 5–15
-    std::map<int, std::vector<int>> rules = {
-        {0, {1, 2}},        // initial branching
-        {1, {5, 6}},        // terminal
-        {2, {3, 4}},        // leads to terminals
-        {3, {7, 8}},        // terminal
-        {4, {9, 10}},       // terminal
-        {5, {}}, {6, {}}, {7, {}}, {8, {}}, {9, {}}, {10, {}},
-        {11, {}}, {12, {}}, {13, {}}, {14, {}}, {15, {}}
-    };
-
-    std::vector<int> melody;
-    std::vector<int> tree;
-
-    // Start with a safe axiom
-    tree.push_back(0);
-
-    int iterations = 0;
-    const int maxIterations = 20;
-
-    while (!tree.empty() && melody.size() < 10 && iterations < maxIterations) {
-        int current = tree.front();
-        tree.erase(tree.begin());
+  Mesh lod[numLevels];
+};
 
-        if (rules.find(current) != rules.end() && !rules[current].empty()) {
-            std::vector<int> expansion = rules[current];
-            std::random_shuffle(expansion.begin(), expansion.end());
-            tree.insert(tree.end(), expansion.begin(), expansion.end());
-        } else {
-            melody.push_back(current);
-        }
+// Values of the trigger parameters shared by Harm and Melody, copied once at
+// the start of every audio block so the sample loop only reads plain floats
+struct VoiceSnapshot
+{
+  float frequency;
+  float amplitude;
+  float attackTime;
+  float releaseTime;
+  float sustain;
+  float pan;
+};
 
-        iterations++;
-    }
+// Handles to those parameters, resolved when the voice creates them in init().
+// Reading through these is a pointer dereference instead of a search through
+// the voice's parameters by name.
+struct VoiceParameters
+{
+  std::shared_ptr<Parameter> frequency;
+  std::shared_ptr<Parameter> amplitude;
+  std::shared_ptr<Parameter> attackTime;
+  std::shared_ptr<Parameter> releaseTime;
+  std::shared_ptr<Parameter> sustain;
+  std::shared_ptr<Parameter> pan;
 
-    // Fallback
-    if (melody.empty()) {
-        melody.push_back(rnd::uniform(5, 16)); // pick a terminal
-    }
+  // Order of the fields in VoiceSnapshot, for Command::SetParam
+  enum Field { Frequency, Amplitude, AttackTime, ReleaseTime, Sustain, Pan };
 
-    // Convert to melody MIDI notes from melodyDictionary
-    const std::vector<int> &scale = melodyDictionary[chordName];
-    std::vector<int> finalMelody;
-    for (int symbol : melody) {
-        int index = symbol % scale.size(); // safely wrap
-        finalMelody.push_back(scale[index]);
-    }
+  VoiceSnapshot snapshot() const
+  {
+    return {frequency->get(), amplitude->get(), attackTime->get(),
+            releaseTime->get(), sustain->get(), pan->get()};
+  }
 
-    return finalMelody;
+  void set(const VoiceSnapshot &v)
+  {
+    frequency->set(v.frequency);
+    amplitude->set(v.amplitude);
+    attackTime->set(v.attackTime);
+    releaseTime->set(v.releaseTime);
+    sustain->set(v.sustain);
+    pan->set(v.pan);
   }
 
+  Parameter &field(int f)
+  {
+    const std::shared_ptr<Parameter> *all[] = {&frequency, &amplitude, &attackTime,
+                                               &releaseTime, &sustain, &pan};
+    return **all[f];
+  }
 };
 
+// Everything the other threads ask the audio thread to do. Built by the
+// sender and applied by MyApp::applyCommand at the start of the next block,
+// so only the audio thread ever touches sounding voices and players.
+struct Command
+{
+  enum Type { NoteOn, NoteOff, SetParam, PlaySample };
+  enum Target { Harmony, Melody, Samples };
+
+  Type type;
+  Target target;
+  int id;              // note id (-1 for every voice with SetParam), or sample index
+  double time;         // commandTime() when sent
+  VoiceSnapshot voice; // NoteOn: all the parameters of the new voice
+  int field;           // SetParam: VoiceParameters::Field
+  float value;         // SetParam: new value, PlaySample: gain
+  int64_t frame = -1;  // audio frame to apply it at, -1 for the next block
+  bool played = false; // NoteOn from a player, its latency goes in inputLatency
+};
 
-
-class Harm : public SynthVoice 
+// Everything Harm and Melody share: the block rendered DSP, the trigger
+// parameters, sample accurate release, and what VoicePool and VoiceRenderer
+// need. The subclasses only add their graphics.
+template <class Osc>
+class BlockSynthVoice : public SynthVoice
 {
 public:
-// Unit generators
-  gam::Pan<> mPan;
-  gam::Sine<> mOsc;
-  gam::ADSR<> mAmpEnv;
-  // envelope follower to connect audio output to graphics
-  gam::EnvFollow<> mEnvFollow;
-  // Draw parameters
-  Mesh mHarm;
-  double rotateA;
-  double rotateB;
-  double spin = al::rnd::uniformS();
+  // Unit generators: oscillator, ADSR, envelope follower (connects audio
+  // output to graphics) and pan, rendered a block at a time
+  BlockVoice<Osc> mDSP;
+  VoiceParameters params;
+  VoiceSnapshot block; // parameters for the audio block being rendered
+  double rate = 48000;  // and its sample rate
+  int releaseFrame = -1; // frame in the current block to release at, see releaseAt()
+  // Voice stealing, see VoicePool
+  int64_t startFrame = 0;
+  int priority = 0;
+  bool stolen = false;
+  // Draw state
+  double rotateA = 0;
+  double rotateB = 0;
   double timepose = 0;
-  Vec3f note_position;
-  Vec3f note_direction;
 
-  void init() override
+  void createParameters()
   {
-    mAmpEnv.curve(0); // linear segments
-    mAmpEnv.levels(0, 1, 1, 0);
-    mAmpEnv.sustainPoint(2);
- 
-    //      mVibEnv.curve(0);
-    addSphere(mHarm, 1, 100, 100);
-    mHarm.decompress();
-    mHarm.generateNormals();
-
-    // Create parameters
-    createInternalTriggerParameter("frequency", 440, 10, 4000.0);
-    createInternalTriggerParameter("amplitude", 0.05, 0.0, 1.0);
-    createInternalTriggerParameter("attackTime", 0.1, 0.01, 3.0);
-    createInternalTriggerParameter("releaseTime", 0.5, 0.1, 10.0);
-    createInternalTriggerParameter("sustain", 0.65, 0.1, 1.0);
-    createInternalTriggerParameter("pan", 0.0, -1.0, 1.0);
-
+    params.frequency = createInternalTriggerParameter("frequency", 440, 10, 4000.0);
+    params.amplitude = createInternalTriggerParameter("amplitude", 0.05, 0.0, 1.0);
+    params.attackTime = createInternalTriggerParameter("attackTime", 0.1, 0.01, 3.0);
+    params.releaseTime = createInternalTriggerParameter("releaseTime", 0.5, 0.1, 10.0);
+    params.sustain = createInternalTriggerParameter("sustain", 0.65, 0.1, 1.0);
+    params.pan = createInternalTriggerParameter("pan", 0.0, -1.0, 1.0);
   }
 
   void onProcess(AudioIOData &io) override
   {
     //Get Parameters
-    mOsc.freq(getInternalParameterValue("frequency"));
-    mPan.pos(getInternalParameterValue("pan"));
-    float amp = getInternalParameterValue("amplitude");
-    while (io())
-    {
-      float s1 = mOsc() * mAmpEnv() * amp;
-      float s2;
-      mEnvFollow(s1);
-      mPan(s1, s1, s2);
-      io.out(0) += s1;
-      io.out(1) += s2;
-    }
-    if (mAmpEnv.done() && (mEnvFollow.value() < 0.001))
+    block = params.snapshot();
+    double sr = io.framesPerSecond();
+    mDSP.osc.freq(block.frequency, sr);
+
+    // The PolySynth leaves io at this voice's start offset in the buffer
+    int start = io.frame() + 1;
+    int frames = (int)io.framesPerBuffer() - start;
+    if (releaseFrame >= 0)
+    {
+      mDSP.env.releaseAfter(releaseFrame - start);
+      releaseFrame = -1;
+    }
+    io.frame(io.framesPerBuffer());
+
+    if (mDSP.env.done() && (mDSP.follow.value() < 0.001))
+    {
       free();
+      return;
+    }
+    // Rendered later by the VoiceRenderer when it has workers
+    rate = sr;
+    if (frames > 0 && !VoiceRenderer::instance().add(this, start, frames))
+      renderJob(io.outBuffer(0) + start, io.outBuffer(1) + start, frames);
   }
 
-  //Replace with obj
-  void onProcess(Graphics &g) override
+  // Renders the block onProcess set up, on the audio thread or a worker
+  void renderJob(float *left, float *right, int frames)
   {
-    rotateA += 0.29;
-    rotateB += 0.23;
-    timepose -= 0.06;
-    g.pushMatrix();
-    g.depthTesting(true);
-    g.lighting(true);
-    g.translate(timepose, getInternalParameterValue("frequency") / 200 - 3, -4);
-    g.rotate(rotateA, Vec3f(0, 1, 0));
-    g.rotate(rotateB, Vec3f(1));
-    float scaling = getInternalParameterValue("amplitude") / 10;
-    g.scale(scaling + getInternalParameterValue("amplitude") , scaling + getInternalParameterValue("attackTime"), scaling + mEnvFollow.value() * 5);
-    g.color(HSV(getInternalParameterValue("amplitude") * 100, getInternalParameterValue("releaseTime") * 20, 0.5 + getInternalParameterValue("pan")));
-    g.draw(mHarm);
-    g.popMatrix();
+    mDSP.render(left, right, frames, block.amplitude, block.pan, rate);
   }
 
-   void onTriggerOn() override
+  void onTriggerOn() override
   {
     timepose = 10;
-    mAmpEnv.reset();
-
+    mDSP.env.reset();
     updateFromParameters();
-    
   }
 
   void onTriggerOff() override
   {
-    mAmpEnv.triggerRelease();
+    mDSP.env.triggerRelease();
   }
 
-  void updateFromParameters()
-  {
+  // Releases the note `frame` samples into the block about to be rendered
+  void releaseAt(int frame) { releaseFrame = frame; }
 
-    mAmpEnv.attack(getInternalParameterValue("attackTime"));
-    mAmpEnv.release(getInternalParameterValue("releaseTime"));
-    mAmpEnv.sustain(getInternalParameterValue("sustain"));
-    
-    mPan.pos(getInternalParameterValue("pan"));
-  }
-  
-};
-
-class Melody : public SynthVoice
-{
-public:
-// Unit generators
-  gam::Pan<> mPan;
-  gam::Saw<> mOsc;
-  gam::ADSR<> mAmpEnv;
-  // envelope follower to connect audio output to graphics
-  gam::EnvFollow<> mEnvFollow;
-  // Draw parameters
-  Mesh mMel;
-  vector<Mesh> melObj;
-  double rotateA;
-  double rotateB;
-  double spin = al::rnd::uniformS();
-  double timepose = 0;
-  Vec3f note_position;
-  Vec3f note_direction;
-  Scene *melscene{nullptr};
+  float level() const { return mDSP.follow.value(); }
 
-  void init() override
+  // Quick fade from `frame`, the voice's pool needs it for another note
+  void steal(int frame)
   {
-    mAmpEnv.curve(0); // linear segments
-    mAmpEnv.levels(0, 1, 1, 0);
-    mAmpEnv.sustainPoint(2);
- 
-    //Graphics
-    std::string melFile = "../cloud_poly.obj"; 
-    melscene = Scene::import(melFile); 
-    if (!melscene) {
-      printf("error reading %s\n", melFile.c_str());
-      return;
-    }
-    melObj.resize(melscene->meshes());
-    for (int i = 0; i < melscene->meshes(); i += 1) {
-      melscene->mesh(i, melObj[i]);
-    }
-    //addCube(mMel);
-    //mMel.decompress();
-    //mMel.generateNormals();
-
-    // Create parameters
-    createInternalTriggerParameter("frequency", 440, 10, 4000.0);
-    createInternalTriggerParameter("amplitude", 0.05, 0.0, 1.0);
-    createInternalTriggerParameter("attackTime", 0.1, 0.01, 3.0);
-    createInternalTriggerParameter("releaseTime", 0.5, 0.1, 10.0);
-    createInternalTriggerParameter("sustain", 0.65, 0.1, 1.0);
-    createInternalTriggerParameter("pan", 0.0, -1.0, 1.0);
-
+    stolen = true;
+    mDSP.env.release(stealFadeTime);
+    releaseAt(frame);
   }
 
-  void onProcess(AudioIOData &io) override
+  void updateFromParameters()
   {
-    //Get Parameters
-    mOsc.freq(getInternalParameterValue("frequency"));
-    mPan.pos(getInternalParameterValue("pan"));
-    float amp = getInternalParameterValue("amplitude");
-    while (io())
-    {
-      float s1 = mOsc() * mAmpEnv() * amp;
-      float s2;
-      mEnvFollow(s1);
-      mPan(s1, s1, s2);
-      io.out(0) += s1;
-      io.out(1) += s2;
-    }
-    if (mAmpEnv.done() && (mEnvFollow.value() < 0.001))
-      free();
+    mDSP.env.attack(params.attackTime->get());
+    mDSP.env.release(params.releaseTime->get());
+    mDSP.env.sustain(params.sustain->get());
   }
 
-  void onProcess(Graphics &g) override
+protected:
+  // Where the note's shape goes this frame: scaled by loudness, envelope
+  // times and the live level, moving left across the screen
+  void advance(Vec3f &pos, Vec3f &size, float scaling)
   {
     rotateA += 0.29;
     rotateB += 0.23;
     timepose -= 0.06;
-    g.pushMatrix();
-    g.depthTesting(true);
-    g.lighting(true);
-    g.translate(timepose, getInternalParameterValue("frequency") / 200 - 3, -4);
-    g.rotate(rotateA, Vec3f(0, 1, 0));
-    g.rotate(rotateB, Vec3f(1));
-    float scaling = getInternalParameterValue("amplitude") / 10000;
-    g.scale(scaling + getInternalParameterValue("amplitude") , scaling + getInternalParameterValue("attackTime"), scaling + mEnvFollow.value() * 5);
-    g.color(HSV(getInternalParameterValue("amplitude") * 20, getInternalParameterValue("releaseTime") * 20, 0.5 + getInternalParameterValue("pan")));
-    g.draw(melObj[0]);
-    g.popMatrix();
+    float amp = params.amplitude->get();
+    pos = Vec3f(timepose, params.frequency->get() / 200 - 3, -4);
+    size = Vec3f(scaling + amp, scaling + params.attackTime->get(), scaling + mDSP.follow.value() * 5);
   }
 
-   void onTriggerOn() override
+  Transform transform(const Vec3f &pos, const Vec3f &size) const
   {
-    timepose = 10;
-    mAmpEnv.reset();
-
-    updateFromParameters();
-    
+    return Transform()
+        .translate(pos[0], pos[1], pos[2])
+        .rotate(rotateA, 0, 1, 0)
+        .rotate(rotateB, 1, 1, 1)
+        .scale(size[0], size[1], size[2]);
   }
+};
 
-  void onTriggerOff() override
+class Harm : public BlockSynthVoice<BlockSine>
+{
+public:
+  const HarmSphere &mHarm = HarmSphere::get();
+
+  void init() override { createParameters(); }
+
+  void onProcess(Graphics &g) override
   {
-    mAmpEnv.triggerRelease();
+    float amp = params.amplitude->get();
+    Vec3f pos, size;
+    advance(pos, size, amp / 10);
+    float radius = std::max(size[0], std::max(size[1], size[2]));
+    // Drawn with every other voice by MyApp::onDraw, see DrawList
+    DrawList::instance().add(mHarm.forSize(ScreenSize::of(pos, radius)), transform(pos, size),
+                             HSV(amp * 100, params.releaseTime->get() * 20, 0.5 + params.pan->get()));
   }
+};
 
-  void updateFromParameters()
-  {
+class Melody : public BlockSynthVoice<BlockSaw>
+{
+public:
+  MeshCache::Handle melObj; // shared with every other Melody voice
+  static constexpr float maxLodError = 3; // pixels
 
-    mAmpEnv.attack(getInternalParameterValue("attackTime"));
-    mAmpEnv.release(getInternalParameterValue("releaseTime"));
-    mAmpEnv.sustain(getInternalParameterValue("sustain"));
-    
-    mPan.pos(getInternalParameterValue("pan"));
+  void init() override
+  {
+    //Parsed once for the whole process, every voice after the first one only
+    //takes a reference to the cached meshes
+    melObj = MeshCache::instance().get(cloudFile);
+    createParameters();
   }
 
-
+  void onProcess(Graphics &g) override
+  {
+    float amp = params.amplitude->get();
+    Vec3f pos, size;
+    advance(pos, size, amp / 10000);
+    if (!melObj || melObj->empty()) return;
+    // Coarsest baked level whose simplification stays under a few pixels,
+    // so far away or squashed clouds cost a fraction of the triangles
+    float pixelsPerMeshUnit = ScreenSize::of(pos, 0.5f) * std::max({size[0], size[1], size[2]});
+    const Mesh &mesh = melObj->lod(0, maxLodError / std::max(pixelsPerMeshUnit, 1e-6f));
+    DrawList::instance().add(mesh, transform(pos, size),
+                             HSV(amp * 20, params.releaseTime->get() * 20, 0.5 + params.pan->get()));
+  }
 };
 
+// One looping file, from the same bank as the one-shots so it can come out
+// of the asset archive too
 class Ambience {
 public:
-  SoundFilePlayerTS playerTS;
-  std::vector<float> buffer;
-  bool loop = true;
-
-  void init(const std::string &filepath) {
-    if (!playerTS.open(filepath.c_str())) {
-      std::cerr << "File not found: " << filepath << std::endl;
-      return;
-    }
+  SampleBank bank;
+  int sample = -1;
+  int position = 0;
 
-    playerTS.setLoop();
-    playerTS.setPlay();
+  void init(const std::string &filepath, double sampleRate) {
+    sample = bank.load(filepath, sampleRate);
   }
 
   void render(AudioIOData &io) {
-    int frames = (int)io.framesPerBuffer();
-    int channels = playerTS.soundFile.channels;
-    int bufferLength = frames * channels;
-
-    if ((int)buffer.size() < bufferLength) {
-      buffer.resize(bufferLength);
+    if (sample < 0) return;
+    const Sample &s = bank[sample];
+    float *left = io.outBuffer(0), *right = io.outBuffer(1);
+    for (int i = 0, n = (int)io.framesPerBuffer(); i < n; ++i) {
+      left[i] += s.left[position];
+      right[i] += s.right[position];
+      if (++position >= s.frames) position = 0;
     }
-
-    playerTS.getFrames(frames, buffer.data(), bufferLength);
-
-    int second = (channels < 2) ? 0 : 1;
-    while (io()) {
-      int frame = (int)io.frame();
-      int idx = frame * channels;
-      io.out(0) += buffer[idx];
-      io.out(1) += buffer[idx + second];
-    }
-
-    //std::cout << "Ambience playing" << std::endl;
   }
 };
 
 class Emitter {
 public:
-  std::vector<std::string> filepaths;
-  SoundFilePlayerTS playerTS;
-  std::vector<float> buffer;
+  SampleBank bank;          // every file decoded up front
+  OneShotPlayer player{bank};
   float timer = 0.0f;
   float interval = 5.0f; // seconds
 
-  void init(const std::vector<std::string>& paths) {
-    filepaths = paths;
-    buffer.resize(4096); // or something safely large
+  void init(const std::vector<std::string>& paths, double sampleRate) {
+    for (const std::string &path : paths) {
+      bank.load(path, sampleRate);
+    }
   }
 
-  void update(float dt) {
+  // Returns the sample to start when the interval is up, -1 otherwise.
+  // Earlier one-shots keep ringing.
+  int update(float dt) {
     timer += dt;
     if (timer >= interval) {
-      playRandomFile();
       timer = 0.0f;
+      return pickRandomFile();
     }
+    return -1;
   }
 
-  void playRandomFile() {
-    int index = rnd::uniform<int>(0, filepaths.size() - 1);
-    if (playerTS.open(filepaths[index].c_str())) {
-      playerTS.setNoLoop();
-      playerTS.setPlay();
-    } else {
-      std::cerr << "Could not open file: " << filepaths[index] << std::endl;
-    }
+  int pickRandomFile() {
+    if (bank.size() == 0) return -1;
+    return rnd::uniform<int>(0, bank.size() - 1);
   }
 
   void render(AudioIOData& io) {
-    int frames = (int)io.framesPerBuffer();
-    int channels = playerTS.soundFile.channels;
-    int bufferLength = frames * channels;
-    if ((int)buffer.size() < bufferLength) {
-      buffer.resize(bufferLength);
-    }
-
-    playerTS.getFrames(frames, buffer.data(), bufferLength);
-    int second = (channels < 2) ? 0 : 1;
-
-    while (io()) {
-      int frame = (int)io.frame();
-      int idx = frame * channels;
-      io.out(0) += buffer[idx];
-      io.out(1) += buffer[idx + second];
-    }
-
-    //std::cout << "Emitter playing" << std::endl;
+    player.render(io.outBuffer(0), io.outBuffer(1), (int)io.framesPerBuffer());
   }
 };
 
@@ -494,6 +423,10 @@ class MyApp : public App, public MIDIMessageHandler
 public:
   SynthGUIManager<Harm> harmManager{"Harm"};
   SynthGUIManager<Melody> melManager{"Melody"};
+  // Every voice either synth will ever play, allocated by initAudio()
+  VoicePool<Harm> harmPool{harmManager.synth()};
+  VoicePool<Melody> melPool{melManager.synth()};
+  int stealPolicy = 0; // StealPolicy, for the Engine panel
 
   Ambience amb;
   Emitter emitter;
@@ -503,15 +436,55 @@ public:
   int midiNote;
   float tscale = 1;
 
-  Mesh mSpectrogram;
-  vector<float> spectrum;
+  Spectrogram mSpectrogram;
+  unsigned lastSpectrum = 0; // analyzer.published() when mSpectrogram was last updated
   bool showGUI = true;
   bool showSpectro = true;
   bool navi = false;
-  gam::STFT stft = gam::STFT(FFT_SIZE, FFT_SIZE / 4, 0, gam::HANN, gam::MAG_FREQ);
+  SpectrumAnalyzer analyzer; // STFT runs on its own thread
+  SoftClipper masterClip;
+  // Note, parameter and sample commands for the audio thread, one lane per
+  // sending thread
+  enum { kControlLane, kMidiLane, kNumLanes };
+  CommandQueue<Command> commands{kNumLanes, 256};
+  // Timings of the audio callback, one lap per stage of onSound
+  enum { kHarmStage, kMelodyStage, kVoiceStage, kAmbienceStage, kEmitterStage, kMasterStage };
+  AudioTimer audioTimer{{"harm", "melody", "voices", "ambience", "emitter", "master"}};
+  // Same for the visual loop, per frame
+  enum { kGuiFrameStage, kScoreFrameStage, kVoiceFrameStage, kSpectroFrameStage, kImguiFrameStage, kSkyFrameStage };
+#if FRAME_TIMERS
+  FrameTimer frameTimer{{"gui", "score", "voices", "spectrogram", "imgui draw", "skybox"}};
+#endif
+  // Threads rendering voices next to the audio thread, see VoiceRenderer.
+  // Off unless asked for with --workers, --render-scaling shows if it helps
+  int renderWorkers = 0;
+
+  // Sample clock. The audio thread counts the frames it has rendered and
+  // holds timed commands until their block; the score is written in frames,
+  // a little ahead of the audio.
+  double sampleRate = 48000;
+  int framesPerBuffer = 512;
+  int64_t audioFrame = 0;                   // audio thread
+  std::atomic<int64_t> framesPlayed{0};     // audioFrame, for other threads
+  PendingCommands<Command, 256> pending;
+  const double lookahead = 0.1;             // seconds the score runs ahead
+  int64_t nextHarmFrame = -1;
+  int64_t nextMelodyFrame = -1;
+
+  // Live input. MIDI is stamped on arrival and placed one block after the
+  // frame the audio clock was at then, so notes keep their spacing instead
+  // of snapping to block starts.
+  AudioClock audioClock;                    // audio thread -> MIDI thread
+  double blockTime = 0;                     // audio thread, commandTime() at the block start
+  TimingHistogram inputLatency;             // key or note-on to its first rendered sample
+  bool midiLoopback = false;                // --midi-loopback: test notes through a virtual port
+  std::atomic<double> loopbackSent{0};      // commandTime() of the last test note
+  std::atomic<bool> loopbackStop{false};
+  std::thread loopbackThread;
+  bool oversampleClip = false;
+  int fftSizeIndex = 2;       // into fftSizes
 
   //Harmony related
-  float timeSinceLastHarm = 0;
   float triggerInterval = 11.0f;
 
   NoteDecision noteDecision;
@@ -520,15 +493,25 @@ public:
   int harmNote2;
 
   //Melody related
-  std::vector<int> currentMelody;
+  int currentMelody[NoteDecision::maxMelody];
+  int melodyLength = 0;
   int currentMelodyIndex = 0;
-  float melodyTimeAccum = 0.0f;
   float melodyNoteDuration = 1.0f; 
   int currentMelNote = -1;
 
+  //Keeps the cloud mesh alive (and parsed before the first note) for the
+  //lifetime of the app
+  MeshCache::Handle cloudMesh;
+
   //Skybox 
   Mesh mskyBox;
-  Texture skyboxTexture;
+  Texture skyboxTexture; // a flat placeholder until skyboxLoader is done
+  AsyncTexture skyboxLoader;
+  double archiveOpenMs = 0, soundLoadMs = 0; // startup timing
+  std::chrono::steady_clock::time_point createdAt;
+  double firstFrameMs = -1;
+
+  bool offline = false; // rendering to a file with renderOffline()
 
   void onInit() override
   {
@@ -536,23 +519,18 @@ public:
 
     navControl().active(false); // Disable navigation via keyboard, since we
                                 // will be using keyboard for note triggering
-    // Set sampling rate for Gamma objects from app's audio
-    gam::sampleRate(audioIO().framesPerSecond());
-
-    amb.init("../amb.wav");
-
-    //emitter.init("../a.wav");
+    initAudio(audioIO().framesPerSecond(), audioIO().framesPerBuffer());
 
-    emitter.init({
-    "../a.wav",
-    "../b.wav",
-    "../c.wav"
-    });
-
-    
 
     // Check for connected MIDI devices
-    if (midiIn.getPortCount() > 0)
+    if (midiLoopback)
+    {
+      // Our own virtual input, fed by runMidiLoopback()
+      MIDIMessageHandler::bindTo(midiIn);
+      midiIn.openVirtualPort("Final loopback");
+      loopbackThread = std::thread([this] { runMidiLoopback(200); });
+    }
+    else if (midiIn.getPortCount() > 0)
     {
       // Bind ourself to the RtMidiIn object, to have the onMidiMessage()
       // callback called whenever a MIDI message is received
@@ -569,134 +547,713 @@ public:
     {
       printf("Error: No MIDI devices found.\n");
     }
-    // Declare the size of the spectrum
-    spectrum.resize(FFT_SIZE / 2 + 1);
 
+    // Start the analysis thread, the spectrum has FFT_SIZE / 2 + 1 bins
+    analyzer.start(FFT_SIZE);
+
+
+  }
+
+  // Audio side setup shared by the live app and renderOffline()
+  void initAudio(double sampleRate, int framesPerBuffer)
+  {
+    this->sampleRate = sampleRate;
+    this->framesPerBuffer = framesPerBuffer;
+    // Set sampling rate for Gamma objects from app's audio
+    gam::sampleRate(sampleRate);
+
+    auto assetsStart = std::chrono::steady_clock::now();
+    amb.init(ambienceFile, sampleRate);
+    emitter.init(sampleFiles, sampleRate);
+    soundLoadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - assetsStart).count();
 
+    masterClip.setup(2, framesPerBuffer);
+
+    // Both synths get all their voices now, with room for two chords of
+    // keys or MIDI on top of the score, plus stolen notes still fading
+    harmPool.allocate(16, 8);
+    melPool.allocate(16, 8);
+    VoiceRenderer::instance().start(renderWorkers, framesPerBuffer);
   }
 
   void onCreate() override
   {
+    createdAt = std::chrono::steady_clock::now();
     harmManager.synthRecorder().verbose(true);
     melManager.synthRecorder().verbose(true);
     nav().pos(3, 0, 17);
 
-    //Skybox related
+    auto meshStart = std::chrono::steady_clock::now();
+    cloudMesh = MeshCache::instance().get(cloudFile);
+    printf("Startup assets from %s: sounds %.1f ms, meshes %.1f ms, archive opened in %.2f ms\n",
+           AssetArchive::instance().isOpen() ? "the archive" : "loose files", soundLoadMs,
+           std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - meshStart).count(),
+           archiveOpenMs);
+    HarmSphere::get(); // build the shared sphere before any voice needs it
+
+    //Skybox related. The image decodes (or comes out of its mip cache) in
+    // the background, a dusk blue stands in for the first frames.
     addSphereWithTexcoords(mskyBox, 1.0, 160, true);
-    auto file = File::currentPath() + "../skybox.jpg";
-    auto image = Image(file);
-    skyboxTexture.create2D(image.width(), image.height());
-    skyboxTexture.submit(image.array().data(), GL_RGBA, GL_UNSIGNED_BYTE);
+    skyboxLoader.start(skyboxPath());
+    const uint8_t placeholder[4] = {52, 66, 96, 255};
+    skyboxTexture.create2D(1, 1);
+    skyboxTexture.submit(placeholder, GL_RGBA, GL_UNSIGNED_BYTE);
     skyboxTexture.filter(Texture::LINEAR);
-
-
   }
 
   void onSound(AudioIOData &io) override
   {
-    harmManager.render(io); // Render audio
+    audioTimer.begin();
+    blockTime = commandTime();
+    audioClock.tick(audioFrame, io.framesPerBuffer(), io.framesPerSecond(), blockTime);
+    harmPool.beginBlock();
+    melPool.beginBlock();
+    // Everything the other threads asked for since the last block. Timed
+    // commands wait in `pending` until the block they fall in.
+    commands.drain([this](const Command &c) {
+      if (c.frame < 0) applyCommand(c, 0);
+      else pending.insert(c);
+    });
+    pending.release(audioFrame, io.framesPerBuffer(),
+                    [this](const Command &c, int offset) { applyCommand(c, offset); });
+
+    // The synths only update their voice lists and queue the voices, which
+    // are rendered all together, in parallel, by the VoiceRenderer
+    harmManager.render(io);
+    audioTimer.lap(kHarmStage); // includes the commands above
     melManager.render(io);
+    audioTimer.lap(kMelodyStage);
+    VoiceRenderer::instance().run(io.outBuffer(0), io.outBuffer(1), io.framesPerBuffer());
+    audioTimer.lap(kVoiceStage);
     
     amb.render(io);
+    audioTimer.lap(kAmbienceStage);
     emitter.render(io);
+    audioTimer.lap(kEmitterStage);
     //amb.render(io);
    
 
-    // STFT
-    while (io())
+    // Master soft clip, whole buffer and all channels at once
+    float *channels[2] = {io.outBuffer(0), io.outBuffer(1)};
+    masterClip.process(channels, 2, io.framesPerBuffer());
+
+    // STFT, only hand the samples over here, the analysis thread does the rest
+    if (!offline)
+      analyzer.push(io.outBuffer(0), io.framesPerBuffer());
+    audioTimer.lap(kMasterStage);
+
+    int voices = countVoices(harmManager.synth()) + countVoices(melManager.synth()) +
+                 emitter.player.activeVoices();
+    audioTimer.end(io.framesPerBuffer() / io.framesPerSecond(), voices);
+
+    audioFrame += io.framesPerBuffer();
+    framesPlayed.store(audioFrame, std::memory_order_release);
+
+  }
+
+  void onAnimate(double dt) override
+  {
+    FRAME_TIMER_BEGIN(frameTimer);
+    navControl().active(navi); // Disable navigation via keyboard, since we
     {
-      io.out(0) = tanh(io.out(0));
-      io.out(1) = tanh(io.out(1));
-      //io.out(2) = tanh(io.out(2));
-      
-      if (stft(io.out(0)))
-      { // Loop through all the frequency bins
-        for (unsigned k = 0; k < stft.numBins(); ++k)
-        {
-          // Here we simply scale the complex sample
-          spectrum[k] = tanh(pow(stft.bin(k).real(), 1.3));
-          // spectrum[k] = stft.bin(k).real();
+      FRAME_TIMER_SCOPE(frameTimer, kGuiFrameStage);
+      imguiBeginFrame();
+      harmManager.drawSynthControlPanel();
+      melManager.drawSynthControlPanel();
+      ParameterGUI::drawParameterMIDI(&parameterMIDI);
+      drawEnginePanel();
+      imguiEndFrame();
+    }
+
+    FRAME_TIMER_SCOPE(frameTimer, kScoreFrameStage);
+    advanceScore(dt);
+  }
+
+  // Generative scheduling: harmony changes and melody steps are placed on
+  // the audio sample clock and sent `lookahead` seconds early, so they start
+  // on their exact frame whatever the frame rate. Emitter one-shots still
+  // follow dt. Driven by onAnimate live and by the audio block clock in
+  // renderOffline().
+  void advanceScore(double dt)
+  {
+    const int64_t now = framesPlayed.load(std::memory_order_acquire);
+    const int64_t harmEvery = (int64_t)llround(triggerInterval * sampleRate);
+    const int64_t melodyEvery = (int64_t)llround(melodyNoteDuration * sampleRate);
+    if (nextHarmFrame < 0)
+    {
+      nextHarmFrame = now + harmEvery;
+      nextMelodyFrame = now + melodyEvery;
+    }
+
+    // Everything up to the horizon; the extra block covers the one the audio
+    // thread may be rendering right now
+    const int64_t horizon = now + (int64_t)(lookahead * sampleRate) + framesPerBuffer;
+    while (std::min(nextHarmFrame, nextMelodyFrame) < horizon)
+    {
+      if (nextHarmFrame <= nextMelodyFrame)
+      {
+        //For Gen harm
+        const int64_t at = nextHarmFrame;
+        genHarmOff(at);
+        genHarmOn(at);
+        updateMelody();
+        nextHarmFrame += harmEvery;
+        nextMelodyFrame = at + melodyEvery; // new melody starts a step later
+      }
+      else
+      {
+        const int64_t at = nextMelodyFrame;
+        if (melodyLength > 0) {
+            MelodyOff(at); // always turn off the previous one
+            currentMelodyIndex = (currentMelodyIndex + 1) % melodyLength;
+            MelodyOn(at); // play the next one
+            if (!offline)
+              std::cout <<"Current Melody Note: " << currentMelody[currentMelodyIndex] << std::endl;
         }
+        nextMelodyFrame += melodyEvery;
       }
     }
 
+    int sample = emitter.update(dt);
+    if (sample >= 0)
+      commands.push(kControlLane, {Command::PlaySample, Command::Samples, sample,
+                                   commandTime(), {}, 0, 1.0f});
+
 
   }
 
-  void onAnimate(double dt) override
+  // Decodes every asset into one archive, in the form the loaders use at
+  // runtime: PCM at the app's rate, the baked meshes, the sky's mip chain.
+  // The OBJs have to be baked with objbake first.
+  int packAssets(const std::string &path)
   {
-    navControl().active(navi); // Disable navigation via keyboard, since we
-    imguiBeginFrame();
-    harmManager.drawSynthControlPanel();
-    melManager.drawSynthControlPanel();
-    ParameterGUI::drawParameterMIDI(&parameterMIDI);
-    imguiEndFrame();
+    AssetArchiveWriter pack;
+    vector<string> sounds = sampleFiles;
+    sounds.insert(sounds.begin(), ambienceFile);
+    for (const string &file : sounds)
+    {
+      SampleBank bank;
+      if (bank.load(file, 48000) < 0) return 1;
+      pack.add(file, AssetType::Sound, AssetArchiveWriter::sound(bank[0].left, bank[0].right, bank[0].frames, 48000));
+    }
+
+    MappedFile bakedFile;
+    BinaryMeshFile baked;
+    const string bakedPath = MeshCache::binaryPath(cloudFile);
+    if (!bakedFile.open(bakedPath) || !baked.view(bakedFile.data(), bakedFile.size(), bakedPath) ||
+        !baked.matchesSource(cloudFile))
+    {
+      std::cerr << bakedPath << " is missing or stale, run objbake on " << cloudFile << " first" << std::endl;
+      return 1;
+    }
+    pack.add(cloudFile, AssetType::Mesh, vector<uint8_t>(bakedFile.data(), bakedFile.data() + bakedFile.size()));
 
-    //For Gen harm
+    const string sky = skyboxPath();
+    Image image;
+    if (!image.load(sky))
+    {
+      std::cerr << "Could not load " << sky << std::endl;
+      return 1;
+    }
+    MipChain chain;
+    chain.build(image.array().data(), (int)image.width(), (int)image.height());
+    pack.add(sky, AssetType::Texture, chain.serialize(sky));
+
+    if (!pack.write(path)) return 1;
+    printf("Packed %d assets into %s\n", (int)sounds.size() + 2, path.c_str());
+    return 0;
+  }
 
-    timeSinceLastHarm += dt;
-    //std::cout << "Time since last harmonic:not working " << timeSinceLastHarm << std::endl;
+  // Renders the piece to a WAV file with no window or audio device. The
+  // score runs on a virtual clock that advances one audio block at a time,
+  // through the same commands and voices as live, as fast as the CPU allows.
+  int renderOffline(double minutes, const std::string &path)
+  {
+    offline = true;
+    initAudio(48000, 512);
+    AudioIOData io;
+    offlineIO(io);
 
-    if (timeSinceLastHarm >= triggerInterval)
+    WavWriter wav;
+    if (!wav.open(path, 2, (int)sampleRate))
     {
-      genHarmOff();  
-      genHarmOn(); 
-      updateMelody();
-      timeSinceLastHarm = 0;
-      //std::cout << "Generated Harmonic in if" << std::endl;
+      std::cerr << "Could not write " << path << std::endl;
+      return 1;
     }
 
-    melodyTimeAccum += dt;
-    if (!currentMelody.empty() && melodyTimeAccum >= melodyNoteDuration) {
-        MelodyOff(); // always turn off the previous one
-        currentMelodyIndex = (currentMelodyIndex + 1) % currentMelody.size();
-        MelodyOn(); // play the next one
-        melodyTimeAccum = 0.0f;
-        std::cout <<"Current Melody Note: " << currentMelody[currentMelodyIndex] << std::endl;
+    const long long blocks = (long long)(minutes * 60 * sampleRate / framesPerBuffer);
+    if ((uint64_t)blocks * framesPerBuffer > WavWriter::maxFrames(2))
+    {
+      std::cerr << "A WAV file holds at most " << WavWriter::maxFrames(2) / sampleRate / 60
+                << " minutes" << std::endl;
+      return 1;
+    }
+    const double blockTime = framesPerBuffer / sampleRate;
+    auto begin = std::chrono::steady_clock::now();
+    for (long long b = 0; b < blocks; ++b)
+    {
+      advanceScore(blockTime);
+      io.zeroOut();
+      io.frame(0);
+      onSound(io);
+      const float *channels[2] = {io.outBuffer(0), io.outBuffer(1)};
+      if (!wav.write(channels, framesPerBuffer))
+      {
+        std::cerr << "Could not write " << path << std::endl;
+        return 1;
+      }
     }
+    wav.close();
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    double rendered = blocks * blockTime;
+    printf("Rendered %.1f s to %s in %.2f s, %.1fx real time\n", rendered,
+           path.c_str(), wall, rendered / wall);
+    audioTimer.dump(stdout);
+    return 0;
+  }
 
-    emitter.update(dt);
+  // Polyphony against worker threads: for each worker count, holds N
+  // harmony notes for `seconds` of offline rendering and times every
+  // block. Prints the mean block time and the speedup over
+  // rendering everything on the audio thread.
+  int renderScaling(double seconds)
+  {
+    offline = true;
+    initAudio(48000, 512);
+    AudioIOData io;
+    offlineIO(io);
+
+    // 24 is what the live app allocates (16 plus 8 reserve)
+    const int polyphonies[] = {8, 24, 64, 128, 256, 512};
+    const int numPolyphonies = 6;
+    harmPool.allocate(512, 8);
+    const int cores = (int)std::max(1u, std::thread::hardware_concurrency());
+    std::vector<int> workerCounts{0};
+    for (int w = 1; w < cores && w <= 8; w *= 2) workerCounts.push_back(w);
+    if (workerCounts.back() != std::min(cores - 1, 8) && cores > 1)
+      workerCounts.push_back(std::min(cores - 1, 8));
+
+    std::vector<double> micros(workerCounts.size() * numPolyphonies);
+    const long long blocks = (long long)(seconds * sampleRate / framesPerBuffer);
+    for (size_t w = 0; w < workerCounts.size(); ++w)
+    {
+      VoiceRenderer::instance().start(workerCounts[w], framesPerBuffer);
+      for (int p = 0; p < numPolyphonies; ++p)
+      {
+        // This is the audio thread, so the notes go straight to applyCommand
+        for (int i = 0; i < polyphonies[p]; ++i)
+          applyCommand({Command::NoteOn, Command::Harmony, 1000 + i, 0,
+                        {harmony::midiToFrequency(36 + i % 60), 0.5f / polyphonies[p], 0.01f,
+                         0.2f, 1.0f, rnd::uniformS()}}, 0);
+        double total = 0;
+        for (long long b = 0; b < blocks + 10; ++b)
+        {
+          io.zeroOut();
+          io.frame(0);
+          auto begin = std::chrono::steady_clock::now();
+          onSound(io);
+          if (b >= 10) // past the attacks and the workers' first wakeup
+            total += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        }
+        micros[w * numPolyphonies + p] = total / blocks * 1e6;
 
+        // Let them all finish before the next setting
+        for (int i = 0; i < polyphonies[p]; ++i)
+          applyCommand({Command::NoteOff, Command::Harmony, 1000 + i}, 0);
+        for (int b = 0; b < sampleRate / framesPerBuffer; ++b)
+        {
+          io.zeroOut();
+          io.frame(0);
+          onSound(io);
+        }
+      }
+    }
+    VoiceRenderer::instance().stop();
+
+    printf("Audio callback, mean us per %d frame block (speedup over 0 workers), %d cores\n",
+           framesPerBuffer, cores);
+    printf("%8s", "voices");
+    for (int workers : workerCounts) printf("  %9d wkr", workers);
+    printf("\n");
+    for (int p = 0; p < numPolyphonies; ++p)
+    {
+      printf("%8d", polyphonies[p]);
+      for (size_t w = 0; w < workerCounts.size(); ++w)
+        printf("  %7.0f (%.1fx)", micros[w * numPolyphonies + p],
+               micros[p] / micros[w * numPolyphonies + p]);
+      printf("\n");
+    }
 
+    // Headroom with every voice on the audio thread: the share of the block's
+    // deadline used, and how many voices would fit at this cost per voice.
+    // The whole callback is charged to the voices, so `fit` errs low.
+    const double deadline = 1e6 * framesPerBuffer / sampleRate;
+    printf("\n0 workers, %.0f us deadline per block\n", deadline);
+    printf("%8s  %10s  %6s  %10s\n", "voices", "us/voice", "load", "fit");
+    for (int p = 0; p < numPolyphonies; ++p)
+    {
+      double perVoice = micros[p] / polyphonies[p];
+      printf("%8d  %10.2f  %5.1f%%  %10.0f\n", polyphonies[p], perVoice,
+             100 * micros[p] / deadline, deadline / perVoice);
+    }
+
+    // What reading the voice parameters costs per block: the snapshot each
+    // voice takes through its handles, against looking the same six up by
+    // name the way the voices used to
+    const char *const names[] = {"frequency", "amplitude", "attackTime", "releaseTime", "sustain", "pan"};
+    printf("\nParameter reads, us per block for all voices\n");
+    printf("%8s  %10s  %10s\n", "voices", "handles", "by name");
+    for (int p = 0; p < numPolyphonies; ++p)
+    {
+      if (polyphonies[p] < 64) continue;
+      for (int i = 0; i < polyphonies[p]; ++i)
+        applyCommand({Command::NoteOn, Command::Harmony, 1000 + i, 0,
+                      {harmony::midiToFrequency(36 + i % 60), 0.5f / polyphonies[p], 0.01f,
+                       0.2f, 1.0f, rnd::uniformS()}}, 0);
+      io.zeroOut();
+      io.frame(0);
+      onSound(io); // puts them on the active list
+
+      const int reps = 2000;
+      float sum = 0;
+      auto begin = std::chrono::steady_clock::now();
+      for (int r = 0; r < reps; ++r)
+        for (SynthVoice *v = harmManager.synth().getActiveVoices(); v; v = v->next)
+          sum += static_cast<Harm *>(v)->params.snapshot().frequency;
+      double handles = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+      begin = std::chrono::steady_clock::now();
+      for (int r = 0; r < reps; ++r)
+        for (SynthVoice *v = harmManager.synth().getActiveVoices(); v; v = v->next)
+          for (const char *name : names) sum += v->getInternalParameterValue(name);
+      double byName = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+      volatile float keep = sum; // so the reads aren't optimized out
+      (void)keep;
+      printf("%8d  %10.2f  %10.2f\n", polyphonies[p], handles / reps * 1e6, byName / reps * 1e6);
+
+      for (int i = 0; i < polyphonies[p]; ++i)
+        applyCommand({Command::NoteOff, Command::Harmony, 1000 + i}, 0);
+      for (int b = 0; b < sampleRate / framesPerBuffer; ++b)
+      {
+        io.zeroOut();
+        io.frame(0);
+        onSound(io);
+      }
+    }
+    return 0;
+  }
+
+  // Checks of the audio path that need no window or device, like the
+  // offline render. Prints each result, 1 if any failed.
+  int selfTest()
+  {
+    offline = true;
+    initAudio(48000, 512);
+    AudioIOData io;
+    offlineIO(io);
+
+    int failed = 0;
+    failed += !checkSameBlockRelease(io);
+    failed += !SelfTest::checkClockError();
+    failed += !SelfTest::checkMelodyOrder();
+    VoiceRenderer::instance().stop();
+    printf("Self test: %s\n", failed ? "FAILED" : "passed");
+    return failed ? 1 : 0;
+  }
+
+  // A NoteOff in the same block as its NoteOn, before the synth has the
+  // voice in its active list, still has to release it
+  bool checkSameBlockRelease(AudioIOData &io)
+  {
+    const int id = 4242;
+    const int64_t at = audioFrame + 100;
+    noteOn(kControlLane, Command::Harmony, id, {440, 0.2f, 0.01f, 0.1f, 0.8f, 0}, at);
+    noteOff(kControlLane, Command::Harmony, id, at + 50);
+
+    // 10 ms attack and 100 ms release, it's gone well within half a second
+    int sounding = 0, blocks = 0;
+    const int maxBlocks = (int)(0.5 * sampleRate / framesPerBuffer);
+    do
+    {
+      io.zeroOut();
+      io.frame(0);
+      onSound(io);
+      sounding = countVoices(harmManager.synth());
+    } while (sounding > 0 && ++blocks < maxBlocks);
+
+    const bool ok = blocks > 0 && sounding == 0;
+    printf("  note on and off in one block: %s after %d blocks\n",
+           ok ? "released" : "still sounding", blocks);
+    return ok;
+  }
+
+  // Buffers for rendering without an audio device
+  void offlineIO(AudioIOData &io)
+  {
+    io.framesPerSecond(sampleRate);
+    io.framesPerBuffer(framesPerBuffer);
+    io.channelsOut(2);
+    io.channelsIn(0);
+  }
+
+  static int countVoices(PolySynth &synth)
+  {
+    int n = 0;
+    for (SynthVoice *v = synth.getActiveVoices(); v; v = v->next) ++n;
+    return n;
+  }
+
+  // Senders, for any thread that owns `lane`
+  // frame: audio frame to play at, -1 for as soon as possible
+  void noteOn(int lane, Command::Target target, int id, const VoiceSnapshot &voice,
+              int64_t frame = -1)
+  {
+    commands.push(lane, {Command::NoteOn, target, id, commandTime(), voice, 0, 0, frame});
+  }
+
+  void noteOff(int lane, Command::Target target, int id, int64_t frame = -1)
+  {
+    commands.push(lane, {Command::NoteOff, target, id, commandTime(), {}, 0, 0, frame});
+  }
+
+  // Audio thread only. offset is the frame within the coming block.
+  void applyCommand(const Command &c, int offset)
+  {
+    switch (c.type)
+    {
+    case Command::NoteOn:
+      if (c.played)
+        inputLatency.add(blockTime + offset / sampleRate - c.time);
+      if (c.target == Command::Harmony) startVoice(harmPool, harmManager.synth(), c, offset);
+      else startVoice(melPool, melManager.synth(), c, offset);
+      break;
+    case Command::NoteOff:
+      if (c.target == Command::Harmony) releaseVoices(harmPool, c.id, offset);
+      else releaseVoices(melPool, c.id, offset);
+      break;
+    case Command::SetParam:
+      if (c.target == Command::Harmony) setVoiceParam(harmPool, c);
+      else setVoiceParam(melPool, c);
+      break;
+    case Command::PlaySample:
+      emitter.player.start(c.id, c.value);
+      break;
+    }
+  }
+
+  // Takes a voice from the pool and starts it with the parameters in the
+  // command, instead of copying them from the GUI voice like
+  // SynthGUIManager::triggerOn. Played notes outrank the score's when the
+  // pool steals by priority.
+  template <class V>
+  void startVoice(VoicePool<V> &pool, PolySynth &synth, const Command &c, int offset)
+  {
+    V *voice = pool.start(audioFrame + offset, offset, c.played ? 1 : 0);
+    if (!voice) return;
+    voice->params.set(c.voice);
+    // Cleared before triggerOn instead of in onTriggerOn, so a NoteOff
+    // later in this block sticks whenever the synth gets to onTriggerOn
+    voice->releaseAt(-1);
+    synth.triggerOn(voice, offset, c.id);
+  }
+
+  // PolySynth::triggerOff can only release at the start of a block. The
+  // pool also has the voices started this block, not yet in the synth's
+  // active list, so a note can start and end inside one block.
+  template <class V>
+  void releaseVoices(VoicePool<V> &pool, int id, int offset)
+  {
+    pool.forEach([&](V *v) {
+      if (v->id() == id) v->releaseAt(offset);
+    });
+  }
+
+  template <class V>
+  void setVoiceParam(VoicePool<V> &pool, const Command &c)
+  {
+    pool.forEach([&](V *v) {
+      if (c.id < 0 || v->id() == c.id) v->params.field(c.field).set(c.value);
+    });
   }
 
   void onDraw(Graphics &g) override
   {
     g.clear();
-    harmManager.render(g);
-    melManager.render(g);
+    if (firstFrameMs < 0)
+      firstFrameMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - createdAt).count();
+    if (skyboxLoader.update(skyboxTexture))
+      printf("Skybox: %s in %.1f ms on a background thread, first frame at %.1f ms, sky shown at %.1f ms\n",
+             skyboxLoader.source(), skyboxLoader.loadMs(),
+             firstFrameMs, skyboxLoader.shownMs());
+    ScreenSize::eye = Vec3f(nav().pos()[0], nav().pos()[1], nav().pos()[2]);
+    ScreenSize::pixelsPerUnit = height() / (2 * tan(lens().fovy() * M_PI / 360));
+    // Voices only queue their instances; they're drawn here in one batch
+    // per mesh
+    {
+      FRAME_TIMER_SCOPE(frameTimer, kVoiceFrameStage);
+      harmManager.render(g);
+      melManager.render(g);
+      DrawList::instance().draw(g);
+    }
     // // Draw Spectrum
-    mSpectrogram.reset();
-    mSpectrogram.primitive(Mesh::LINE_STRIP);
     if (showSpectro)
     {
-      for (int i = 0; i < FFT_SIZE / 2; i++)
+      FRAME_TIMER_SCOPE(frameTimer, kSpectroFrameStage);
+      // Buffers only change size with the FFT size; otherwise the line and
+      // one waterfall row are rewritten when a new spectrum is published
+      int bins = analyzer.numBins() - 1;
+      if (mSpectrogram.bins() != bins)
       {
-        mSpectrogram.color(HSV(0.5 - spectrum[i] * 100));
-        mSpectrogram.vertex(i, spectrum[i], 0.0);
+        // A lone note at the voices' default amplitude, panned center, is
+        // the reference level
+        mSpectrogram.init(bins, 256, SpectrumAnalyzer::sineLevel(0.05f * std::sqrt(0.5f)));
+        lastSpectrum = 0;
+      }
+      unsigned published = analyzer.published();
+      if (published != lastSpectrum)
+      {
+        mSpectrogram.update(analyzer.spectrum());
+        lastSpectrum = published;
       }
       g.meshColor(); // Use the color in the mesh
       g.pushMatrix();
       g.translate(-3, -3, 0);
-      g.scale(10.0 / FFT_SIZE, 100, 1.0);
-      g.draw(mSpectrogram);
+      g.pushMatrix();
+      g.scale(5.0 / bins, 1.0, 1.0);
+      mSpectrogram.drawLine(g);
+      g.popMatrix();
+      // Waterfall history just below the line
+      g.scale(5.0, 2.4, 1.0);
+      mSpectrogram.drawWaterfall(g);
       g.popMatrix();
     }
     // GUI is drawn here
     if (showGUI)
     {
+      FRAME_TIMER_SCOPE(frameTimer, kImguiFrameStage);
       imguiDraw();
     }
 
     //Skybox
+    FRAME_TIMER_SCOPE(frameTimer, kSkyFrameStage);
     g.depthTesting(true);
     skyboxTexture.bind();
     g.texture();
     g.draw(mskyBox);
   }
 
+  void drawEnginePanel()
+  {
+    static const char *fftSizes[] = {"1024", "2048", "4096", "8192", "16384"};
+    ImGui::Begin("Engine");
+    if (ImGui::Checkbox("2x oversampled clipper", &oversampleClip))
+    {
+      masterClip.oversample(oversampleClip);
+    }
+    if (ImGui::Combo("FFT size", &fftSizeIndex, fftSizes, 5))
+    {
+      // Restarting swaps the analysis buffers, fine here since onDraw
+      // (the only reader) runs on this thread
+      analyzer.start(atoi(fftSizes[fftSizeIndex]));
+    }
+    ImGui::Text("Dropped samples: %d", (int)analyzer.droppedSamples());
+
+    // Audio callback timing, against the length of one block
+    ImGui::Separator();
+    ImGui::Text("Callback deadline %.2f ms, missed %llu of %llu",
+                audioTimer.deadline() * 1e3,
+                (unsigned long long)audioTimer.deadlineMisses(),
+                (unsigned long long)audioTimer.total().count());
+    ImGui::Text("Voices %d (max %d)", audioTimer.voices(), audioTimer.maxVoices());
+    static const char *stealPolicies[] = {"oldest", "quietest", "lowest priority"};
+    if (ImGui::Combo("Voice stealing", &stealPolicy, stealPolicies, 3))
+    {
+      harmPool.policy((StealPolicy)stealPolicy);
+      melPool.policy((StealPolicy)stealPolicy);
+    }
+    ImGui::Text("Stolen %llu harm, %llu melody; dropped %llu", (unsigned long long)harmPool.stolen(),
+                (unsigned long long)melPool.stolen(),
+                (unsigned long long)(harmPool.dropped() + melPool.dropped()));
+    ImGui::Text("Voice visuals: %d instances in %d draws, %lld triangles", DrawList::instance().instances(),
+                DrawList::instance().batches(), (long long)DrawList::instance().triangles());
+    // Off draws each voice through Graphics with allolib's own lighting
+    bool instanced = !DrawList::instance().direct();
+    if (ImGui::Checkbox("Instanced voice drawing", &instanced))
+      DrawList::instance().direct(!instanced);
+    ImGui::Text("Timed commands late %llu, dropped %llu", (unsigned long long)pending.late(),
+                (unsigned long long)pending.dropped());
+    ImGui::Text("Input to sound %.2f ms mean, %.2f p99, %.2f max (%llu notes)",
+                inputLatency.mean() * 1e3, inputLatency.percentile(0.99) * 1e3,
+                inputLatency.max() * 1e3, (unsigned long long)inputLatency.count());
+    ImGui::Text("%-10s %8s %8s %8s", "us", "mean", "p99", "max");
+    for (int s = 0; s <= audioTimer.numStages(); ++s)
+    {
+      bool total = s == audioTimer.numStages();
+      const TimingHistogram &h = total ? audioTimer.total() : audioTimer.stage(s);
+      ImGui::Text("%-10s %8.1f %8.1f %8.1f", total ? "total" : audioTimer.name(s).c_str(),
+                  h.mean() * 1e6, h.percentile(0.99) * 1e6, h.max() * 1e6);
+    }
+#if FRAME_TIMERS
+    ImGui::Separator();
+    drawFrameGraph();
+#endif
+    ImGui::End();
+  }
+
+#if FRAME_TIMERS
+  // Stacked bars of the last frames' stage times, newest on the right, with
+  // a line at 60 fps, then a legend with each stage's mean
+  void drawFrameGraph()
+  {
+    static const ImU32 colors[] = {IM_COL32(230, 159, 0, 255),   IM_COL32(86, 180, 233, 255),
+                                   IM_COL32(0, 158, 115, 255),   IM_COL32(240, 228, 66, 255),
+                                   IM_COL32(204, 121, 167, 255), IM_COL32(213, 94, 0, 255),
+                                   IM_COL32(120, 120, 120, 255)}; // last one is "other"
+    const int stages = frameTimer.numStages(), frames = frameTimer.frames();
+    float top = 1000.0f / 30; // scale to the slowest frame, at least 30 fps
+    for (int i = 0; i < frames; ++i) top = std::max(top, frameTimer.total(i));
+
+    ImGui::Text("Frame time, last %d frames (0 to %.1f ms)", frames, top);
+    const float width = std::max(ImGui::GetContentRegionAvail().x, 240.0f), height = 80;
+    const ImVec2 origin = ImGui::GetCursorScreenPos();
+    ImDrawList *draw = ImGui::GetWindowDrawList();
+    const float barWidth = width / (FrameTimer::numFrames - 1);
+    for (int i = 0; i < frames; ++i)
+    {
+      const float x = origin.x + width - (frames - i) * barWidth;
+      float y = origin.y + height;
+      for (int s = 0; s <= stages; ++s)
+      {
+        const float h = frameTimer.time(i, s) / top * height;
+        if (h <= 0) continue;
+        draw->AddRectFilled(ImVec2(x, y - h), ImVec2(x + std::max(barWidth, 1.0f), y), colors[std::min(s, 6)]);
+        y -= h;
+      }
+    }
+    const float sixty = origin.y + height - (1000.0f / 60) / top * height;
+    draw->AddLine(ImVec2(origin.x, sixty), ImVec2(origin.x + width, sixty), IM_COL32(255, 255, 255, 128));
+    ImGui::Dummy(ImVec2(width, height));
+
+    for (int s = 0; s <= stages; ++s)
+    {
+      const ImU32 c = colors[std::min(s, 6)];
+      ImGui::TextColored(ImVec4((c & 0xff) / 255.0f, ((c >> 8) & 0xff) / 255.0f, ((c >> 16) & 0xff) / 255.0f, 1),
+                         "%-12s %6.2f ms", s < stages ? frameTimer.name(s).c_str() : "other", frameTimer.mean(s));
+    }
+    if (ImGui::Button("Export frame times"))
+    {
+      if (frameTimer.writeCsv("frame_times.csv")) printf("Wrote %d frames to frame_times.csv\n", frames);
+      else printf("Could not write frame_times.csv\n");
+    }
+  }
+#endif
+
+  // MIDI input thread. Only stamps the message and queues it; the audio
+  // thread starts the note at the frame it arrived at, a block later.
   void onMIDIMessage(const MIDIMessage &m)
   {
+    double time = midiLoopback ? loopbackSent.load() : commandTime();
+    int64_t frame = midiFrame(time);
     switch (m.type())
     {
     case MIDIByte::NOTE_ON:
@@ -704,36 +1261,106 @@ public:
       int midiNote = m.noteNumber();
       if (midiNote > 0 && m.velocity() > 0.001)
       {
-        harmManager.voice()->setInternalParameterValue(
-            "frequency", ::pow(2.f, (midiNote - 69.f) / 12.f) * 432.f);
-        melManager.voice()->setInternalParameterValue(
-            "frequency", ::pow(2.f, (midiNote - 69.f) / 12.f) * 432.f);
-        harmManager.voice()->setInternalParameterValue(
-            "attackTime", 0.01 / m.velocity());
-        melManager.voice()->setInternalParameterValue(
-            "attackTime", 0.01 / m.velocity());
-        harmManager.triggerOn(midiNote);
-        melManager.triggerOn(midiNote);
+        // GUI settings, with the note's pitch and a velocity dependent attack
+        VoiceSnapshot harm = harmManager.voice()->params.snapshot();
+        VoiceSnapshot mel = melManager.voice()->params.snapshot();
+        harm.frequency = mel.frequency = harmony::midiToFrequency(midiNote);
+        harm.attackTime = mel.attackTime = 0.01 / m.velocity();
+        playNote(kMidiLane, midiNote, harm, mel, time, frame);
       }
       else
       {
-        harmManager.triggerOff(midiNote);
-        melManager.triggerOff(midiNote);
+        releaseNote(kMidiLane, midiNote, time, frame);
       }
       break;
     }
     case MIDIByte::NOTE_OFF:
+      releaseNote(kMidiLane, m.noteNumber(), time, frame);
+      break;
+    case MIDIByte::CONTROL_CHANGE:
     {
-      int midiNote = m.noteNumber();
-      printf("Note OFF %u, Vel %f", m.noteNumber(), m.velocity());
-      harmManager.triggerOff(midiNote);
-      melManager.triggerOff(midiNote);
+      // Pan (CC 10) moves every voice that's sounding
+      if (m.controlNumber() == 10)
+      {
+        float pan = m.controlValue() * 2 - 1;
+        for (Command::Target target : {Command::Harmony, Command::Melody})
+          commands.push(kMidiLane, {Command::SetParam, target, -1, time, {},
+                                    VoiceParameters::Pan, pan, frame});
+      }
       break;
     }
     default:;
     }
   }
 
+  // Audio frame for input that arrived at `time`, -1 (next block) before
+  // audio has started. Input can arrive just after a callback, so a block
+  // is the least delay that's the same for every message. AudioClock keeps
+  // frameAt() within a few frames of a steady line (see its comment); input
+  // right after an unusually early callback can still land that much before
+  // the next block and plays at its start.
+  int64_t midiFrame(double time)
+  {
+    int64_t frame = audioClock.frameAt(time);
+    return frame < 0 ? -1 : frame + framesPerBuffer;
+  }
+
+  // A played note on both synths, timed for inputLatency
+  void playNote(int lane, int midiNote, const VoiceSnapshot &harm, const VoiceSnapshot &mel,
+                double time, int64_t frame = -1)
+  {
+    for (Command::Target target : {Command::Harmony, Command::Melody})
+    {
+      Command c{Command::NoteOn, target, midiNote, time,
+                target == Command::Harmony ? harm : mel, 0, 0, frame};
+      c.played = true;
+      commands.push(lane, c);
+    }
+  }
+
+  void releaseNote(int lane, int midiNote, double time, int64_t frame = -1)
+  {
+    for (Command::Target target : {Command::Harmony, Command::Melody})
+      commands.push(lane, {Command::NoteOff, target, midiNote, time, {}, 0, 0, frame});
+  }
+
+  // Input latency test for --midi-loopback: plays `notes` notes into our own
+  // virtual MIDI input through a second virtual port, then prints how long
+  // each took from being sent to its first rendered sample. Virtual ports
+  // need ALSA or CoreMIDI.
+  void runMidiLoopback(int notes)
+  {
+    RtMidiOut out;
+    unsigned port = out.getPortCount();
+    for (unsigned i = 0; i < out.getPortCount(); ++i)
+      if (out.getPortName(i).find("Final loopback") != std::string::npos) port = i;
+    if (port == out.getPortCount())
+    {
+      printf("MIDI loopback: no \"Final loopback\" port to send to\n");
+      return;
+    }
+    out.openPort(port);
+
+    std::vector<unsigned char> message(3);
+    for (int i = 0; i < notes && !loopbackStop; ++i)
+    {
+      // 4 notes a second, on and off, so there is always a block in between
+      int note = 60 + i % 12;
+      for (unsigned char status : {0x90, 0x80})
+      {
+        message = {status, (unsigned char)note, 100};
+        loopbackSent = commandTime();
+        out.sendMessage(&message);
+        std::this_thread::sleep_for(std::chrono::milliseconds(125));
+      }
+    }
+    printf("MIDI loopback, sent to first rendered sample over %llu notes: mean %.2f ms, "
+           "p50 %.2f, p99 %.2f, max %.2f; %llu late\n",
+           (unsigned long long)inputLatency.count(), inputLatency.mean() * 1e3,
+           inputLatency.percentile(0.5) * 1e3, inputLatency.percentile(0.99) * 1e3,
+           inputLatency.max() * 1e3, (unsigned long long)pending.late());
+  }
+
   bool onKeyDown(Keyboard const &k) override
   {
     if (ParameterGUI::usingKeyboard())
@@ -755,12 +1382,10 @@ public:
         int midiNote = asciiToMIDI(k.key());
         if (midiNote > 0)
         {
-          harmManager.voice()->setInternalParameterValue(
-              "frequency", ::pow(2.f, (midiNote - 69.f) / 12.f) * 432.f);
-          melManager.voice()->setInternalParameterValue(
-              "frequency", ::pow(2.f, (midiNote - 69.f) / 12.f) * 432.f);
-          harmManager.triggerOn(midiNote);
-          melManager.triggerOn(midiNote);
+          VoiceSnapshot harm = harmManager.voice()->params.snapshot();
+          VoiceSnapshot mel = melManager.voice()->params.snapshot();
+          harm.frequency = mel.frequency = harmony::midiToFrequency(midiNote);
+          playNote(kControlLane, midiNote, harm, mel, commandTime());
         }
       }
     }
@@ -789,23 +1414,20 @@ public:
   {
     int midiNote = asciiToMIDI(k.key());
     if (midiNote > 0)
-    {
-      harmManager.triggerOff(midiNote);
-      melManager.triggerOff(midiNote);
-    }
+      releaseNote(kControlLane, midiNote, commandTime());
     std::cout << "Note OFF: " << midiNote << std::endl;
     return true;
   }
 
 
 
-  void genHarmOn() {
-    auto chordNotes = noteDecision.getNextHarmonyChord();
-    std::random_shuffle(chordNotes.begin(), chordNotes.end());
+  void genHarmOn(int64_t at) {
+    int chordNotes[2]; // already in random order
+    noteDecision.getNextHarmonyChord(chordNotes);
 
     for (int i = 0; i < 2; ++i) {
         int midiNote = chordNotes[i];
-        float freq = pow(2.f, (midiNote - 69.f) / 12.f) * 432.f;
+        float freq = harmony::midiToFrequency(midiNote);
 
         // 🎚️ Generate independent random parameters for each voice
         float amp = rnd::uniform(0.1f, 0.6f);
@@ -814,18 +1436,9 @@ public:
         float sustain = rnd::uniform(0.4f, 1.0f);
         float pan = rnd::uniformS(); // stereo position: -1.0 (left) to 1.0 (right)
 
-        Harm *voice = harmManager.voice();
-        if (!voice) continue;
-
-        //Not 100%sure if these are updating for each note or for each set. 
-        voice->setInternalParameterValue("frequency", freq);
-        voice->setInternalParameterValue("amplitude", amp);
-        voice->setInternalParameterValue("attackTime", attack);
-        voice->setInternalParameterValue("releaseTime", release);
-        voice->setInternalParameterValue("sustain", sustain);
-        voice->setInternalParameterValue("pan", pan);
-
-        harmManager.triggerOn(midiNote);
+        // Each note carries its own parameters to the audio thread
+        noteOn(kControlLane, Command::Harmony, midiNote,
+               {freq, amp, attack, release, sustain, pan}, at);
 
         if (i == 0) harmNote1 = midiNote;
         if (i == 1) harmNote2 = midiNote;
@@ -840,41 +1453,32 @@ public:
     }
   }
 
-  void genHarmOff()
+  void genHarmOff(int64_t at)
   {
-    harmManager.triggerOff(harmNote1);
-    harmManager.triggerOff(harmNote2);
+    noteOff(kControlLane, Command::Harmony, harmNote1, at);
+    noteOff(kControlLane, Command::Harmony, harmNote2, at);
   }
 
-  void MelodyOn() {
-      if (currentMelody.empty()) return;
+  void MelodyOn(int64_t at) {
+      if (melodyLength == 0) return;
 
-      if (currentMelodyIndex >= currentMelody.size()) {
+      if (currentMelodyIndex >= melodyLength) {
           currentMelodyIndex = 0; // wrap safely
       }
 
       int midiNote = currentMelody[currentMelodyIndex];
       currentMelNote = midiNote;
 
-      float freq = pow(2.f, (midiNote - 69.f) / 12.f) * 432.f;
+      float freq = harmony::midiToFrequency(midiNote);
 
-      Melody *voice = melManager.voice();
-      if (!voice) return;
-
-      voice->setInternalParameterValue("frequency", freq);
-      voice->setInternalParameterValue("amplitude", rnd::uniform(0.1f, 0.4f));
-      voice->setInternalParameterValue("attackTime", 0.05f);
-      voice->setInternalParameterValue("releaseTime", 0.4f);
-      voice->setInternalParameterValue("sustain", 0.7f);
-      voice->setInternalParameterValue("pan", rnd::uniformS());
-
-      melManager.triggerOn(midiNote);
+      noteOn(kControlLane, Command::Melody, midiNote,
+             {freq, rnd::uniform(0.1f, 0.4f), 0.05f, 0.4f, 0.7f, rnd::uniformS()}, at);
   }
 
 
-  void MelodyOff() {
+  void MelodyOff(int64_t at) {
       if (currentMelNote >= 0) {
-          melManager.triggerOff(currentMelNote);
+          noteOff(kControlLane, Command::Melody, currentMelNote, at);
           currentMelNote = -1;
       }
   }
@@ -883,15 +1487,14 @@ public:
 
   void updateMelody(){
     if (noteDecision.currentChordIndex < 0 || 
-        noteDecision.currentChordIndex >= noteDecision.chordNames.size()) {
+        noteDecision.currentChordIndex >= harmony::numChords) {
         std::cerr << "Invalid currentChordIndex: " << noteDecision.currentChordIndex << std::endl;
         return;
     }
 
-    std::string currentChord = noteDecision.chordNames[noteDecision.currentChordIndex];
-    currentMelody = noteDecision.generateLSystemMelody(currentChord);
+    melodyLength = noteDecision.generateLSystemMelody(noteDecision.currentChordIndex,
+                                                      currentMelody, NoteDecision::maxMelody);
     currentMelodyIndex = 0;
-    melodyTimeAccum = 0.0f;
     currentMelNote = -1;
   }
 
@@ -901,18 +1504,65 @@ public:
 
 
 
-  void onExit() override { imguiShutdown(); }
+  void onExit() override
+  {
+    loopbackStop = true;
+    if (loopbackThread.joinable()) loopbackThread.join();
+    // No more blocks, so nothing can be queued on the workers as they go
+    audioIO().stop();
+    VoiceRenderer::instance().stop();
+    analyzer.stop();
+    audioTimer.dump(stdout);
+    imguiShutdown();
+  }
   
 
 }; 
 
 
 
-int main()
+int main(int argc, char *argv[])
 {
   // Create app instance
   MyApp app;
 
+  // main --pack [archive] writes the asset archive and exits
+  if (argc >= 2 && std::string(argv[1]) == "--pack")
+    return app.packAssets(argc >= 3 ? argv[2] : assetArchiveFile);
+
+  // Everything after this loads from the archive if there is one, unless
+  // --loose asks for the loose files (to compare startup times)
+  bool loose = false;
+  for (int i = 1; i < argc; ++i) loose = loose || std::string(argv[i]) == "--loose";
+  if (!loose)
+  {
+    auto start = std::chrono::steady_clock::now();
+    AssetArchive::instance().open(assetArchiveFile);
+    app.archiveOpenMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  // main --workers <n> renders voices on n threads next to the audio thread
+  for (int i = 1; i + 1 < argc; ++i)
+    if (std::string(argv[i]) == "--workers") app.renderWorkers = atoi(argv[i + 1]);
+
+  // main --render <minutes> <out.wav> [workers] renders offline instead of
+  // opening the window and audio device, with `workers` voice render threads
+  if (argc >= 4 && std::string(argv[1]) == "--render")
+  {
+    if (argc >= 5) app.renderWorkers = atoi(argv[4]);
+    return app.renderOffline(atof(argv[2]), argv[3]);
+  }
+  // main --render-scaling <seconds> prints voice count against render threads
+  if (argc >= 3 && std::string(argv[1]) == "--render-scaling")
+    return app.renderScaling(atof(argv[2]));
+
+  // main --self-test runs the offline checks in selfTest()
+  if (argc >= 2 && std::string(argv[1]) == "--self-test")
+    return app.selfTest();
+
+  // main --midi-loopback runs as usual and measures MIDI input latency
+  app.midiLoopback = argc >= 2 && std::string(argv[1]) == "--midi-loopback";
+
   // Set up audio
   app.configureAudio(48000., 512, 2, 0);
   app.start();
@@ -0,0 +1,380 @@
+// Bakes OBJ files into the .bmesh format read by MeshCache
+// (see BinaryMesh.hpp). Plain C++, no allolib needed:
+//
+//   c++ -std=c++17 -O2 objbake.cpp -o objbake
+//   ./objbake cloud_poly.obj cloud_poly.bmesh [levels]
+//   ./objbake tree.obj tree.bmesh 0
+//
+// One mesh is written per group/material run with faces, in file order, which
+// is how assimp splits these files. Faces are triangulated, vertices are
+// deduplicated, and smooth normals are generated where the OBJ has none.
+//
+// Then each mesh gets `levels` (default 3) simplified levels of detail by
+// vertex clustering: space is cut into a grid, every vertex moves to the mean
+// of the vertices in its cell, and triangles that collapse are dropped. Each
+// level grows the cells until it has at most a quarter of the triangles of
+// the level before. A mesh stops getting levels once simplifying it no
+// longer removes triangles, so small meshes can have fewer than `levels`.
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "BinaryMesh.hpp"
+
+struct BakedMesh
+{
+  std::string name;
+  std::vector<BinaryVertex> vertices;
+  std::vector<uint32_t> indices;
+  std::vector<int> positionOf; // OBJ position index of each vertex
+  bool missingNormals = false;
+  uint32_t lod = 0;
+  uint32_t base = 0;  // index of the full mesh, for levels of detail
+  float cellSize = 0;
+};
+
+static std::string trim(const std::string &s)
+{
+  size_t a = s.find_first_not_of(" \t\r\n");
+  if (a == std::string::npos) return "";
+  size_t b = s.find_last_not_of(" \t\r\n");
+  return s.substr(a, b - a + 1);
+}
+
+// Resolves a 1-based (or negative, relative) OBJ index into a 0-based one
+static int resolveIndex(int idx, size_t count)
+{
+  if (idx > 0) return idx - 1;
+  if (idx < 0) return (int)count + idx;
+  return -1;
+}
+
+static void generateNormals(BakedMesh &mesh, size_t positionCount)
+{
+  // Accumulate area weighted face normals per OBJ position so faces sharing a
+  // corner are smoothed even when their texcoords differ
+  std::vector<float> accum(positionCount * 3, 0.0f);
+  for (size_t t = 0; t + 2 < mesh.indices.size(); t += 3) {
+    const float *a = mesh.vertices[mesh.indices[t]].position;
+    const float *b = mesh.vertices[mesh.indices[t + 1]].position;
+    const float *c = mesh.vertices[mesh.indices[t + 2]].position;
+    float u[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+    float v[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+    float n[3] = {u[1] * v[2] - u[2] * v[1], u[2] * v[0] - u[0] * v[2],
+                  u[0] * v[1] - u[1] * v[0]};
+    for (int k = 0; k < 3; k++) {
+      int p = mesh.positionOf[mesh.indices[t + k]];
+      for (int j = 0; j < 3; j++) accum[p * 3 + j] += n[j];
+    }
+  }
+  for (size_t i = 0; i < mesh.vertices.size(); i++) {
+    const float *n = &accum[mesh.positionOf[i] * 3];
+    float len = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    float inv = len > 0 ? 1.0f / len : 0.0f;
+    for (int j = 0; j < 3; j++) mesh.vertices[i].normal[j] = n[j] * inv;
+  }
+}
+
+static bool readObj(const std::string &path, std::vector<BakedMesh> &meshes)
+{
+  std::ifstream in(path);
+  if (!in) {
+    printf("objbake: could not open %s\n", path.c_str());
+    return false;
+  }
+
+  std::vector<float> positions, normals, texcoords;
+  std::unordered_map<uint64_t, uint32_t> lookup;
+  std::string group = "default";
+  BakedMesh *mesh = nullptr;
+
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.size() < 2 || line[0] == '#') continue;
+    std::istringstream ls(line);
+    std::string tag;
+    ls >> tag;
+    if (tag == "v") {
+      float x = 0, y = 0, z = 0;
+      ls >> x >> y >> z;
+      positions.insert(positions.end(), {x, y, z});
+    } else if (tag == "vn") {
+      float x = 0, y = 0, z = 0;
+      ls >> x >> y >> z;
+      normals.insert(normals.end(), {x, y, z});
+    } else if (tag == "vt") {
+      float u = 0, v = 0;
+      ls >> u >> v;
+      texcoords.insert(texcoords.end(), {u, v});
+    } else if (tag == "g" || tag == "o") {
+      group = trim(line.substr(tag.size()));
+      mesh = nullptr;
+    } else if (tag == "usemtl") {
+      mesh = nullptr; // a new material starts a new mesh
+    } else if (tag == "f") {
+      if (!mesh) {
+        meshes.emplace_back();
+        mesh = &meshes.back();
+        mesh->name = group;
+        lookup.clear();
+      }
+      std::vector<uint32_t> face;
+      std::string corner;
+      while (ls >> corner) {
+        int vi = 0, ti = 0, ni = 0;
+        const char *c = corner.c_str();
+        char *end;
+        vi = (int)strtol(c, &end, 10);
+        if (*end == '/') {
+          c = end + 1;
+          if (*c != '/') ti = (int)strtol(c, &end, 10);
+          else end = (char *)c;
+          if (*end == '/') ni = (int)strtol(end + 1, &end, 10);
+        }
+        int p = resolveIndex(vi, positions.size() / 3);
+        int t = resolveIndex(ti, texcoords.size() / 2);
+        int n = resolveIndex(ni, normals.size() / 3);
+        if (p < 0 || p >= (int)positions.size() / 3) {
+          printf("objbake: bad face index in %s: %s\n", path.c_str(), line.c_str());
+          return false;
+        }
+        uint64_t key = ((uint64_t)(p + 1) << 42) | ((uint64_t)(t + 1) << 21) |
+                       (uint64_t)(n + 1);
+        auto found = lookup.find(key);
+        if (found != lookup.end()) {
+          face.push_back(found->second);
+          continue;
+        }
+        BinaryVertex v = {};
+        memcpy(v.position, &positions[p * 3], sizeof(v.position));
+        if (n >= 0 && n < (int)normals.size() / 3)
+          memcpy(v.normal, &normals[n * 3], sizeof(v.normal));
+        else
+          mesh->missingNormals = true;
+        if (t >= 0 && t < (int)texcoords.size() / 2)
+          memcpy(v.texcoord, &texcoords[t * 2], sizeof(v.texcoord));
+        uint32_t index = (uint32_t)mesh->vertices.size();
+        mesh->vertices.push_back(v);
+        mesh->positionOf.push_back(p);
+        lookup[key] = index;
+        face.push_back(index);
+      }
+      // Fan triangulation, fine for the convex quads these files use
+      for (size_t k = 2; k < face.size(); k++) {
+        mesh->indices.insert(mesh->indices.end(), {face[0], face[k - 1], face[k]});
+      }
+    }
+  }
+
+  for (BakedMesh &m : meshes) {
+    if (m.missingNormals) generateNormals(m, positions.size() / 3);
+  }
+  return true;
+}
+
+// One level of detail of `mesh` by vertex clustering on a grid of cellSize
+static BakedMesh simplify(const BakedMesh &mesh, float cellSize)
+{
+  BakedMesh out;
+  out.name = mesh.name;
+  out.cellSize = cellSize;
+  if (mesh.vertices.empty()) return out;
+
+  float lo[3] = {mesh.vertices[0].position[0], mesh.vertices[0].position[1],
+                 mesh.vertices[0].position[2]};
+  for (const BinaryVertex &v : mesh.vertices)
+    for (int j = 0; j < 3; j++) lo[j] = std::min(lo[j], v.position[j]);
+
+  // Cell of every vertex, and the sum of the vertices in each cell
+  std::unordered_map<uint64_t, uint32_t> cells;
+  std::vector<uint32_t> cellOf(mesh.vertices.size());
+  std::vector<float> counts;
+  for (size_t i = 0; i < mesh.vertices.size(); i++) {
+    const BinaryVertex &v = mesh.vertices[i];
+    uint64_t key = 0;
+    for (int j = 0; j < 3; j++)
+      key = (key << 21) | (uint64_t)((v.position[j] - lo[j]) / cellSize);
+    auto found = cells.emplace(key, (uint32_t)out.vertices.size());
+    if (found.second) {
+      out.vertices.push_back({});
+      counts.push_back(0);
+    }
+    uint32_t c = cellOf[i] = found.first->second;
+    for (int j = 0; j < 3; j++) out.vertices[c].position[j] += v.position[j];
+    for (int j = 0; j < 2; j++) out.vertices[c].texcoord[j] += v.texcoord[j];
+    counts[c] += 1;
+  }
+  for (size_t c = 0; c < out.vertices.size(); c++) {
+    for (int j = 0; j < 3; j++) out.vertices[c].position[j] /= counts[c];
+    for (int j = 0; j < 2; j++) out.vertices[c].texcoord[j] /= counts[c];
+    out.positionOf.push_back((int)c);
+  }
+
+  // Triangles that still span three cells, each only once
+  std::unordered_map<uint64_t, bool> seen;
+  for (size_t t = 0; t + 2 < mesh.indices.size(); t += 3) {
+    uint32_t a = cellOf[mesh.indices[t]], b = cellOf[mesh.indices[t + 1]],
+             c = cellOf[mesh.indices[t + 2]];
+    if (a == b || b == c || a == c) continue;
+    uint32_t s[3] = {a, b, c};
+    std::sort(s, s + 3);
+    if (!seen.emplace(((uint64_t)s[0] << 42) | ((uint64_t)s[1] << 21) | s[2], true).second)
+      continue;
+    out.indices.insert(out.indices.end(), {a, b, c});
+  }
+
+  // Drop the cells no triangle uses
+  std::vector<uint32_t> remap(out.vertices.size(), UINT32_MAX);
+  std::vector<BinaryVertex> used;
+  for (uint32_t &i : out.indices) {
+    if (remap[i] == UINT32_MAX) {
+      remap[i] = (uint32_t)used.size();
+      used.push_back(out.vertices[i]);
+    }
+    i = remap[i];
+  }
+  out.vertices.swap(used);
+  out.positionOf.resize(out.vertices.size());
+  for (size_t i = 0; i < out.positionOf.size(); i++) out.positionOf[i] = (int)i;
+  generateNormals(out, out.vertices.size());
+  return out;
+}
+
+static const size_t kMinLodTriangles = 8;
+
+// Appends `levels` levels of detail of every full mesh, level by level
+static void addLevels(std::vector<BakedMesh> &meshes, int levels)
+{
+  const size_t full = meshes.size();
+  meshes.reserve(full * (levels + 1)); // keeps the pointers below valid
+  std::vector<const BakedMesh *> previous(full); // nullptr once it has all it needs
+  std::vector<float> cell(full);
+  for (size_t i = 0; i < full; i++) {
+    previous[i] = &meshes[i];
+    float extent = 0;
+    for (int j = 0; j < 3; j++) {
+      float lo = INFINITY, hi = -INFINITY;
+      for (const BinaryVertex &v : meshes[i].vertices) {
+        lo = std::min(lo, v.position[j]);
+        hi = std::max(hi, v.position[j]);
+      }
+      if (!meshes[i].vertices.empty()) extent = std::max(extent, hi - lo);
+    }
+    cell[i] = std::max(extent / 128, 1e-6f);
+  }
+
+  for (int level = 1; level <= levels; level++) {
+    for (size_t i = 0; i < full; i++) {
+      if (!previous[i]) continue;
+      const size_t target = previous[i]->indices.size() / 3 / 4;
+      BakedMesh lod = simplify(meshes[i], cell[i]);
+      while (lod.indices.size() / 3 > target) {
+        // Never coarsen a mesh away entirely, a cloud that vanishes at a
+        // distance pops more than one that's a bit too detailed
+        BakedMesh coarser = simplify(meshes[i], cell[i] * 1.25f);
+        if (coarser.indices.size() / 3 < kMinLodTriangles) break;
+        cell[i] *= 1.25f;
+        lod = std::move(coarser);
+      }
+      // At the triangle floor, another level would be a copy of this one
+      if (lod.indices.size() >= previous[i]->indices.size()) {
+        previous[i] = nullptr;
+        continue;
+      }
+      lod.lod = (uint32_t)level;
+      lod.base = (uint32_t)i;
+      meshes.push_back(std::move(lod));
+      previous[i] = &meshes.back();
+    }
+  }
+}
+
+static bool writeBinary(const std::string &path, const std::string &sourcePath,
+                        const std::vector<BakedMesh> &meshes)
+{
+  BinaryMeshHeader header = {};
+  memcpy(header.magic, kBinaryMeshMagic, 4);
+  header.version = kBinaryMeshVersion;
+  fileStamp(sourcePath, header.sourceSize, header.sourceMTime);
+  header.meshCount = (uint32_t)meshes.size();
+
+  std::vector<BinaryMeshEntry> entries(meshes.size());
+  uint64_t offset = sizeof(BinaryMeshHeader) + entries.size() * sizeof(BinaryMeshEntry);
+  for (size_t i = 0; i < meshes.size(); i++) {
+    BinaryMeshEntry &e = entries[i];
+    strncpy(e.name, meshes[i].name.c_str(), sizeof(e.name) - 1);
+    e.vertexCount = (uint32_t)meshes[i].vertices.size();
+    e.indexCount = (uint32_t)meshes[i].indices.size();
+    e.vertexOffset = offset;
+    offset += e.vertexCount * sizeof(BinaryVertex);
+    e.indexOffset = offset;
+    offset += e.indexCount * sizeof(uint32_t);
+    e.lod = meshes[i].lod;
+    e.base = meshes[i].lod ? meshes[i].base : (uint32_t)i;
+    e.cellSize = meshes[i].cellSize;
+  }
+
+  // Write to a temporary name first so a running app never maps a half
+  // written file
+  std::string tmp = path + ".tmp";
+  FILE *f = fopen(tmp.c_str(), "wb");
+  if (!f) {
+    printf("objbake: could not write %s\n", tmp.c_str());
+    return false;
+  }
+  fwrite(&header, sizeof(header), 1, f);
+  fwrite(entries.data(), sizeof(BinaryMeshEntry), entries.size(), f);
+  for (const BakedMesh &m : meshes) {
+    fwrite(m.vertices.data(), sizeof(BinaryVertex), m.vertices.size(), f);
+    fwrite(m.indices.data(), sizeof(uint32_t), m.indices.size(), f);
+  }
+  bool ok = ferror(f) == 0;
+  ok = (fclose(f) == 0) && ok;
+  if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0) {
+    printf("objbake: could not write %s\n", path.c_str());
+    std::remove(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc != 3 && argc != 4) {
+    printf("usage: %s input.obj output.bmesh [levels of detail, default 3]\n", argv[0]);
+    return 1;
+  }
+  const int levels = argc == 4 ? std::max(0, std::min(atoi(argv[3]), 5)) : 3;
+  auto start = std::chrono::steady_clock::now();
+
+  std::vector<BakedMesh> meshes;
+  if (!readObj(argv[1], meshes)) return 1;
+  addLevels(meshes, levels);
+  if (!writeBinary(argv[2], argv[1], meshes)) return 1;
+
+  std::vector<size_t> vertices(levels + 1), triangles(levels + 1), count(levels + 1);
+  for (const BakedMesh &m : meshes) {
+    vertices[m.lod] += m.vertices.size();
+    triangles[m.lod] += m.indices.size() / 3;
+    count[m.lod]++;
+  }
+  const size_t full = count[0];
+  double ms = std::chrono::duration<double, std::milli>(
+                  std::chrono::steady_clock::now() - start).count();
+  printf("%s -> %s: %d meshes, %d vertices, %d triangles (%.1f ms)\n", argv[1],
+         argv[2], (int)full, (int)vertices[0], (int)triangles[0], ms);
+  for (int level = 1; level <= levels; level++)
+    printf("  level %d: %d meshes, %d vertices, %d triangles\n", level, (int)count[level],
+           (int)vertices[level], (int)triangles[level]);
+  return 0;
+}